@@ -67,14 +67,15 @@ defmodule Blinkchain do
   def set_brightness(channel, brightness) do
     with :ok <- validate_channel_number(channel),
          :ok <- validate_uint8(brightness, :brightness),
-         do: GenServer.call(HAL, {:set_brightness, channel, brightness})
+         do: HAL.call({:set_brightness, channel, brightness})
   end
 
   @doc """
   Set the gamma curve to be used for the channel.
 
-  `gamma` is a list of 255 8-bit unsigned integers, which will be used as a
-  look-up table to transform the value of each color component for each pixel.
+  `gamma` is a list of 256 8-bit unsigned integers, which will be used as a
+  look-up table to transform the value of each color component for each pixel,
+  after the brightness and color temperature are applied.
   """
   @spec set_gamma(channel_number(), [uint8()]) ::
           :ok
@@ -83,9 +84,28 @@ defmodule Blinkchain do
   def set_gamma(channel, gamma) do
     with :ok <- validate_channel_number(channel),
          :ok <- validate_gamma(gamma),
-         do: GenServer.call(HAL, {:set_gamma, channel, gamma})
+         do: HAL.call({:set_gamma, channel, gamma})
   end
 
+  @doc """
+  Set the color temperature correction to be used for the channel.
+
+  Each of the red, green and blue components of `color` scales the
+  corresponding component of all pixels in the channel by `component/255`, to
+  correct the white point of the pixels. The white component is ignored.
+  """
+  @spec set_color_temperature(channel_number(), color()) ::
+          :ok
+          | {:error, :invalid, :channel}
+          | {:error, :invalid, :color}
+  def set_color_temperature(channel, %Color{} = color) do
+    with :ok <- validate_channel_number(channel),
+         :ok <- validate_color(color),
+         do: HAL.call({:set_color_temperature, channel, color})
+  end
+
+  def set_color_temperature(channel, {r, g, b}), do: set_color_temperature(channel, %Color{r: r, g: g, b: b})
+
   @doc """
   Set the color of the pixel at a given point on the virtual canvas.
   """
@@ -96,7 +116,7 @@ defmodule Blinkchain do
   def set_pixel(%Point{} = point, %Color{} = color) do
     with :ok <- validate_point(point),
          :ok <- validate_color(color),
-         do: GenServer.call(HAL, {:set_pixel, point, color})
+         do: HAL.call({:set_pixel, point, color})
   end
 
   def set_pixel({x, y}, color), do: set_pixel(%Point{x: x, y: y}, color)
@@ -118,7 +138,7 @@ defmodule Blinkchain do
          :ok <- validate_uint16(width, :width),
          :ok <- validate_uint16(height, :height),
          :ok <- validate_color(color),
-         do: GenServer.call(HAL, {:fill, origin, width, height, color})
+         do: HAL.call({:fill, origin, width, height, color})
   end
 
   def fill({x, y}, width, height, color), do: fill(%Point{x: x, y: y}, width, height, color)
@@ -151,7 +171,7 @@ defmodule Blinkchain do
          :ok <- validate_point(destination, :destination),
          :ok <- validate_uint16(width, :width),
          :ok <- validate_uint16(height, :height),
-         do: GenServer.call(HAL, {:copy, source, destination, width, height})
+         do: HAL.call({:copy, source, destination, width, height})
   end
 
   def copy({x, y}, destination, width, height), do: copy(%Point{x: x, y: y}, destination, width, height)
@@ -176,7 +196,7 @@ defmodule Blinkchain do
          :ok <- validate_point(destination, :destination),
          :ok <- validate_uint16(width, :width),
          :ok <- validate_uint16(height, :height),
-         do: GenServer.call(HAL, {:copy_blit, source, destination, width, height})
+         do: HAL.call({:copy_blit, source, destination, width, height})
   end
 
   def copy_blit({x, y}, destination, width, height), do: copy_blit(%Point{x: x, y: y}, destination, width, height)
@@ -205,17 +225,57 @@ defmodule Blinkchain do
          :ok <- validate_uint16(width, :width),
          :ok <- validate_uint16(height, :height),
          :ok <- validate_data(data, width * height),
-         do: GenServer.call(HAL, {:blit, destination, width, height, normalize_data(data)})
+         do: HAL.call({:blit, destination, width, height, normalize_data(data)})
   end
 
   def blit({x, y}, width, height, data), do: blit(%Point{x: x, y: y}, width, height, data)
 
+  @doc """
+  Read back the region of size `width` by `height`, starting at `origin`, as a
+  binary of raw pixel data in row-major order.
+
+  Canvas locations that aren't associated with a physical NeoPixel read back as
+  if all of their color components were set to `0`.
+
+  ## Options
+  * `format`: The order of color components for each pixel in the returned
+    binary, as any ordering of `rgb` (3 bytes per pixel) or `rgbw` (4 bytes per
+    pixel) (default: `:rgbw`).
+  * `output`: Whether to read the colors that were sent to the LEDs by the last
+    call to `render/0`, after the brightness, color temperature, gamma curve,
+    white extraction and dithering of each pixel's channel, instead of the
+    colors drawn on the canvas (default: `false`).
+  """
+  @spec read_region(point(), uint16(), uint16(), Keyword.t()) ::
+          {:ok, binary()}
+          | {:error, :invalid, :origin}
+          | {:error, :invalid, :width}
+          | {:error, :invalid, :height}
+          | {:error, :invalid, :format}
+          | {:error, :invalid, :output}
+          | {:error, String.t()}
+  def read_region(origin, width, height, opts \\ [])
+
+  def read_region(%Point{} = origin, width, height, opts) do
+    format = Keyword.get(opts, :format, :rgbw)
+    output = Keyword.get(opts, :output, false)
+
+    with :ok <- validate_point(origin, :origin),
+         :ok <- validate_uint16(width, :width),
+         :ok <- validate_uint16(height, :height),
+         :ok <- validate_pixel_format(format),
+         :ok <- validate_boolean(output, :output),
+         do: HAL.call({:read_region, origin, width, height, format, output})
+  end
+
+  def read_region({x, y}, width, height, opts), do: read_region(%Point{x: x, y: y}, width, height, opts)
+
   @doc """
   Render the current canvas state to the physical NeoPixels according to their
   configured locations in the virtual canvas.
   """
   @spec render() :: :ok
-  def render, do: GenServer.call(HAL, :render)
+  def render, do: HAL.call(:render)
 
   # Helpers
 
@@ -254,6 +314,9 @@ defmodule Blinkchain do
   defp validate_uint16(val) when val in 0..65535, do: :ok
   defp validate_uint16(_), do: :error
 
+  defp validate_boolean(val, _tag) when is_boolean(val), do: :ok
+  defp validate_boolean(_, tag), do: {:error, :invalid, tag}
+
   defp validate_channel_number(val) when val in 0..1, do: :ok
   defp validate_channel_number(_), do: {:error, :invalid, :channel}
 
@@ -268,6 +331,20 @@ defmodule Blinkchain do
 
   defp validate_gamma(_), do: {:error, :invalid, :gamma}
 
+  defp validate_pixel_format(format) when is_atom(format) do
+    format
+    |> Atom.to_string()
+    |> String.graphemes()
+    |> Enum.sort()
+    |> case do
+      ["b", "g", "r"] -> :ok
+      ["b", "g", "r", "w"] -> :ok
+      _ -> {:error, :invalid, :format}
+    end
+  end
+
+  defp validate_pixel_format(_), do: {:error, :invalid, :format}
+
   defp validate_point(point, tag \\ :point)
   defp validate_point(%Point{x: x, y: y}, _tag) when x in 0..65535 and y in 0..65535, do: :ok
   defp validate_point(_point, tag), do: {:error, :invalid, tag}
@@ -12,6 +12,7 @@ defmodule Blinkchain.Config do
 
   @typedoc @moduledoc
   @type t :: %__MODULE__{
+          backend: :port | :nif,
           canvas: Canvas.t(),
           channel0: Channel.t(),
           channel1: Channel.t(),
@@ -19,6 +20,7 @@ defmodule Blinkchain.Config do
         }
 
   defstruct [
+    :backend,
     :canvas,
     :channel0,
     :channel1,
@@ -52,6 +54,7 @@ defmodule Blinkchain.Config do
       |> Channel.new(1)
 
     %Config{
+      backend: load_backend_config(Application.get_env(:blinkchain, :backend, :port)),
       canvas: canvas,
       channel0: channel0,
       channel1: channel1,
@@ -61,6 +64,9 @@ defmodule Blinkchain.Config do
 
   # Private Helpers
 
+  defp load_backend_config(backend) when backend in [:port, :nif], do: backend
+  defp load_backend_config(_), do: raise(":blinkchain :backend must be :port or :nif")
+
   defp load_canvas_config({width, height}), do: Canvas.new(width, height)
   defp load_canvas_config(_), do: raise(":blinkchain :canvas dimensions must be configured as {width, height}")
 end
@@ -17,14 +17,27 @@ defmodule Blinkchain.Config.Channel do
     :bgrw
   ]
 
+  @rgbw_types [
+    :rgbw,
+    :rbgw,
+    :grbw,
+    :gbrw,
+    :brgw,
+    :bgrw
+  ]
+
   @moduledoc """
   Represents a single "chain" of pixels of the same type, connected to the same I/O pin.
 
   * `arrangement`: The list of `t:Blinkchain.Config.Strip.t/0` structs that describe each straight section of pixels.
   * `brightness`: The scale factor used for all pixels in the channel (`0`-`255`, default: `255`).
+  * `color_temperature`: An `{r, g, b}` tuple of scale factors (`0`-`255`) used to correct the white point of the
+    pixels in the channel (default: `{255, 255, 255}`).
+  * `dither`: Whether to use temporal dithering to approximate the fractional part of each color component after
+    applying the `brightness`, `gamma` and `color_temperature` over successive frames (default: `false`).
   * `gamma`: A custom gamma curve to apply to the color of each pixel (default is linear).
     Specified as a list of 256 integer values between `0` and `255`, which will be indexed to transform each color channel
-    from the canvas to the hardware pixels.
+    from the canvas to the hardware pixels, after the `brightness` and `color_temperature` have been applied.
   * `invert`: Whether to invert the PWM signal sent to the I/O pin (required by some hardware types (default: `false`).
   * `number`: Which PWM block to use (must be `0` or `1`)
   * `pin`: The I/O pin number to use for this channel (default: `18`)
@@ -37,6 +50,8 @@ defmodule Blinkchain.Config.Channel do
     pixel to full-intensity for each color channel one-by-one and seeing which color actually lights up.
 
     Valid options: `#{inspect(@valid_types)}`
+  * `white_extraction`: Whether to move the part of each color that is common to the red, green and blue components
+    onto the white component (default: `false`). Only valid for the RGBW types: `#{inspect(@rgbw_types)}`
   """
 
   alias Blinkchain.Config.{
@@ -49,20 +64,26 @@ defmodule Blinkchain.Config.Channel do
   @type t :: %__MODULE__{
           arrangement: [Strip.t()],
           brightness: Blinkchain.uint8(),
+          color_temperature: {Blinkchain.uint8(), Blinkchain.uint8(), Blinkchain.uint8()} | nil,
+          dither: boolean(),
           gamma: [Blinkchain.uint8()],
           invert: boolean(),
           number: Blinkchain.channel_number(),
           pin: non_neg_integer(),
-          type: atom()
+          type: atom(),
+          white_extraction: boolean()
         }
 
   defstruct arrangement: [],
             brightness: 255,
+            color_temperature: nil,
+            dither: false,
             gamma: nil,
             invert: false,
             number: nil,
             pin: 0,
-            type: :gbr
+            type: :gbr,
+            white_extraction: false
 
   @doc "Build a `t:Blinkchain.Config.Channel.t/0` struct from given configuration options"
   @spec new(Keyword.t(), Blinkchain.channel_number()) :: Channel.t()
@@ -72,10 +93,13 @@ defmodule Blinkchain.Config.Channel do
     %Channel{number: number}
     |> set_arrangement(Keyword.get(channel_config, :arrangement))
     |> set_brightness(Keyword.get(channel_config, :brightness))
+    |> set_color_temperature(Keyword.get(channel_config, :color_temperature))
+    |> set_dither(Keyword.get(channel_config, :dither))
     |> set_gamma(Keyword.get(channel_config, :gamma))
     |> set_invert(Keyword.get(channel_config, :invert))
     |> set_pin(Keyword.get(channel_config, :pin))
     |> set_type(Keyword.get(channel_config, :type))
+    |> set_white_extraction(Keyword.get(channel_config, :white_extraction))
   end
 
   @doc "Return the hardware PWM channel for a `t:Channel.t/0` or I/O pin"
@@ -116,6 +140,27 @@ defmodule Blinkchain.Config.Channel do
     raise "Channel :brightness must be in 0..255"
   end
 
+  defp set_color_temperature(channel, nil), do: channel
+
+  defp set_color_temperature(channel, {r, g, b} = color_temperature)
+       when r in 0..255 and g in 0..255 and b in 0..255 do
+    %Channel{channel | color_temperature: color_temperature}
+  end
+
+  defp set_color_temperature(_channel, _color_temperature) do
+    raise "Channel :color_temperature must be an {r, g, b} tuple of values in 0..255"
+  end
+
+  defp set_dither(channel, nil), do: channel
+
+  defp set_dither(channel, dither) when dither in [true, false] do
+    %Channel{channel | dither: dither}
+  end
+
+  defp set_dither(_channel, _dither) do
+    raise "Channel :dither must be true or false"
+  end
+
   defp set_gamma(channel, nil), do: channel
 
   defp set_gamma(channel, gamma) when is_list(gamma) and length(gamma) == 256 do
@@ -156,6 +201,21 @@ defmodule Blinkchain.Config.Channel do
   defp set_type(channel, type) when type in @valid_types, do: %Channel{channel | type: type}
   defp set_type(_channel, _), do: raise("Channel :type must be one of #{inspect(@valid_types)}")
 
+  defp set_white_extraction(channel, nil), do: channel
+  defp set_white_extraction(channel, false), do: %Channel{channel | white_extraction: false}
+
+  defp set_white_extraction(%Channel{type: type} = channel, true) when type in @rgbw_types do
+    %Channel{channel | white_extraction: true}
+  end
+
+  defp set_white_extraction(_channel, true) do
+    raise "Channel :white_extraction requires one of the RGBW types: #{inspect(@rgbw_types)}"
+  end
+
+  defp set_white_extraction(_channel, _white_extraction) do
+    raise "Channel :white_extraction must be true or false"
+  end
+
   defp load_section(%{type: :matrix} = matrix_config) do
     matrix_config
     |> Matrix.new()
@@ -6,6 +6,7 @@ defmodule Blinkchain.HAL do
   alias Blinkchain.{
     Color,
     Config,
+    NIF,
     Point
   }
 
@@ -17,7 +18,7 @@ defmodule Blinkchain.HAL do
 
   defmodule State do
     @moduledoc false
-    defstruct [:config, :port, :subscriber]
+    defstruct [:backend, :config, :port, :subscriber]
   end
 
   def start_link(opts) do
@@ -30,6 +31,38 @@ defmodule Blinkchain.HAL do
     GenServer.start_link(__MODULE__, %{config: config, subscriber: subscriber}, name: __MODULE__)
   end
 
+  # Send a request from the `Blinkchain` API to the configured backend.
+  # With the `:nif` backend, this calls directly into the NIF from the calling
+  # process instead of going through the `Blinkchain.HAL` mailbox.
+  def call(request) do
+    case Application.get_env(:blinkchain, :backend, :port) do
+      :nif -> NIF.call(request)
+      _ -> GenServer.call(__MODULE__, request)
+    end
+  end
+
+  def init(%{config: %Config{backend: :nif} = config, subscriber: subscriber}) do
+    with :ok <- NIF.load(),
+         :ok <-
+           NIF.init(
+             config.dma_channel,
+             config.channel0.pin,
+             Channel.total_count(config.channel0),
+             config.channel0.type,
+             config.channel1.pin,
+             Channel.total_count(config.channel1),
+             config.channel1.type
+           ) do
+      # API calls go straight to the NIF instead of queueing up behind an
+      # `:init_canvas` message, so the canvas has to be ready before returning.
+      state = %State{backend: :nif, config: config, subscriber: subscriber}
+      init_canvas_and_channels(state)
+      {:ok, state}
+    else
+      {:error, reason} -> {:stop, "blinkchain NIF failed to initialize: #{reason}"}
+    end
+  end
+
   def init(%{config: config, subscriber: subscriber}) do
     filename =
       :blinkchain
@@ -57,7 +90,7 @@ defmodule Blinkchain.HAL do
       ])
 
     send(self(), :init_canvas)
-    {:ok, %State{config: config, port: port, subscriber: subscriber}}
+    {:ok, %State{backend: :port, config: config, port: port, subscriber: subscriber}}
   end
 
   # This is intended to be used for testing.
@@ -71,6 +104,10 @@ defmodule Blinkchain.HAL do
 
   # This is intended to be used for testing. It doesn't do anything useful
   # in a real application.
+  def handle_call(:print_topology, {_from, _ref}, %State{backend: :nif} = state) do
+    {:reply, :ok, state}
+  end
+
   def handle_call(:print_topology, {_from, _ref}, state) do
     {:reply, send_to_port("print_topology\n", state.port), state}
   end
@@ -80,7 +117,11 @@ defmodule Blinkchain.HAL do
   end
 
   def handle_call({:set_gamma, channel, gamma}, {_from, _ref}, state) do
-    {:reply, send_to_port("set_gamma #{channel} #{Base.encode64(gamma)}\n", state.port), state}
+    {:reply, run({:set_gamma, channel, :erlang.list_to_binary(gamma)}, state), state}
+  end
+
+  def handle_call({:set_color_temperature, channel, %Color{r: r, g: g, b: b}}, {_from, _ref}, state) do
+    {:reply, send_to_port("set_color_temperature #{channel} #{r} #{g} #{b}\n", state.port), state}
   end
 
   def handle_call({:set_pixel, %Point{x: x, y: y}, %Color{r: r, g: g, b: b, w: w}}, {_from, _ref}, state) do
@@ -105,15 +146,29 @@ defmodule Blinkchain.HAL do
     {:reply, send_to_port("blit #{x} #{y} #{width} #{height} #{length} #{base64_data}\n", state.port), state}
   end
 
+  def handle_call({:read_region, %Point{x: x, y: y}, width, height, format, output}, {_from, _ref}, state) do
+    source = if output, do: "output", else: "canvas"
+
+    reply =
+      "read_region #{x} #{y} #{width} #{height} #{format} #{source}\n"
+      |> send_to_port(state.port)
+      |> case do
+        {:ok, payload} ->
+          [_length, base64_data] = String.split(payload, " ", parts: 2)
+          {:ok, Base.decode64!(base64_data)}
+
+        error -> error
+      end
+
+    {:reply, reply, state}
+  end
+
   def handle_call(:render, {_from, _ref}, state) do
     {:reply, send_to_port("render\n", state.port), state}
   end
 
-  def handle_info(:init_canvas, %{config: config, port: port} = state) do
-    init_canvas(config.canvas, port)
-    init_channel(0, config.channel0, port)
-    init_channel(1, config.channel1, port)
-
+  def handle_info(:init_canvas, state) do
+    init_canvas_and_channels(state)
     {:noreply, state}
   end
 
@@ -128,38 +183,46 @@ defmodule Blinkchain.HAL do
 
   # Private Helpers
 
-  defp init_canvas(%Canvas{width: width, height: height}, port) do
-    "init_canvas #{width} #{height}\n"
-    |> send_to_port(port)
+  defp init_canvas_and_channels(%State{config: config} = state) do
+    init_canvas(config.canvas, state)
+    init_channel(0, config.channel0, state)
+    init_channel(1, config.channel1, state)
+  end
+
+  defp init_canvas(%Canvas{width: width, height: height}, state) do
+    run({:init_canvas, width, height}, state)
   end
 
-  defp init_channel(_, nil, _port), do: nil
+  defp init_channel(_, nil, _state), do: nil
 
-  defp init_channel(channel_num, %Channel{} = channel, port) do
+  defp init_channel(channel_num, %Channel{} = channel, state) do
     invert = if channel.invert, do: 1, else: 0
+    run({:set_invert, channel_num, invert}, state)
+    run({:set_brightness, channel_num, channel.brightness}, state)
 
-    "set_invert #{channel_num} #{invert}\n"
-    |> send_to_port(port)
+    if channel.gamma do
+      run({:set_gamma, channel_num, :erlang.list_to_binary(channel.gamma)}, state)
+    end
 
-    "set_brightness #{channel_num} #{channel.brightness}\n"
-    |> send_to_port(port)
+    if channel.color_temperature do
+      {r, g, b} = channel.color_temperature
+      run({:set_color_temperature, channel_num, r, g, b}, state)
+    end
 
-    if channel.gamma do
-      gamma =
-        channel.gamma
-        |> Enum.reduce(<<>>, fn val, acc -> <<acc::binary, val::size(8)>> end)
-        |> Base.encode64()
+    if channel.white_extraction do
+      run({:set_white_extraction, channel_num, 1}, state)
+    end
 
-      "set_gamma #{channel_num} #{gamma}\n"
-      |> send_to_port(port)
+    if channel.dither do
+      run({:set_dither, channel_num, 1}, state)
     end
 
     channel.arrangement
     |> with_pixel_offset()
-    |> Enum.map(fn {offset, strip} -> init_pixels(channel_num, offset, strip, port) end)
+    |> Enum.map(fn {offset, strip} -> init_pixels(channel_num, offset, strip, state) end)
   end
 
-  defp init_pixels(channel_num, offset, %Strip{origin: {x, y}, count: count, direction: direction}, port) do
+  defp init_pixels(channel_num, offset, %Strip{origin: {x, y}, count: count, direction: direction}, state) do
     {dx, dy} =
       case direction do
         :right -> {1, 0}
@@ -168,8 +231,7 @@ defmodule Blinkchain.HAL do
         :up -> {0, -1}
       end
 
-    "init_pixels #{channel_num} #{offset} #{x} #{y} #{count} #{dx} #{dy}\n"
-    |> send_to_port(port)
+    run({:init_pixels, channel_num, offset, x, y, count, dx, dy}, state)
   end
 
   defp with_pixel_offset(arrangement, offset \\ 0)
@@ -179,6 +241,22 @@ defmodule Blinkchain.HAL do
     [{offset, strip} | with_pixel_offset(rest, offset + strip.count)]
   end
 
+  # Run a low-level command, given as a tuple of the command name and its
+  # arguments, which map directly onto both the Port protocol and the NIF.
+  defp run({:set_gamma, channel, gamma}, %State{backend: :port, port: port}) do
+    send_to_port("set_gamma #{channel} #{Base.encode64(gamma)}\n", port)
+  end
+
+  defp run(command, %State{backend: :port, port: port}) do
+    line = command |> Tuple.to_list() |> Enum.join(" ")
+    send_to_port("#{line}\n", port)
+  end
+
+  defp run(command, %State{backend: :nif}) do
+    [name | args] = Tuple.to_list(command)
+    apply(NIF, name, args)
+  end
+
   defp send_to_port(command, port) do
     Port.command(port, command)
     receive_from_port(port)
@@ -186,6 +264,7 @@ defmodule Blinkchain.HAL do
 
   defp receive_from_port(port) do
     receive do
+      {^port, {:data, {:noeol, 'OK: ' ++ response}}} -> receive_continuation(port, to_string(response))
       {^port, {:data, {_, 'OK: ' ++ response}}} -> {:ok, to_string(response)}
       {^port, {:data, {_, 'OK'}}} -> :ok
       {^port, {:data, {_, 'ERR: ' ++ response}}} -> {:error, to_string(response)}
@@ -195,6 +274,35 @@ defmodule Blinkchain.HAL do
     end
   end
 
+  # Replies longer than the Port's line length (e.g. from `read_region`) arrive
+  # in several chunks, and start with the length of the data that follows.
+  # The debug output for the same command is still in the mailbox ahead of the
+  # later chunks, so only collect chunks that aren't debug output until all of
+  # the data has arrived, and leave the rest for `handle_info/2`.
+  defp receive_continuation(port, response) do
+    [length, data] = String.split(response, " ", parts: 2)
+    receive_continuation(port, String.to_integer(length) - byte_size(data), [response])
+  end
+
+  defp receive_continuation(_port, remaining, response) when remaining <= 0 do
+    {:ok, IO.iodata_to_binary(response)}
+  end
+
+  defp receive_continuation(port, remaining, response) do
+    receive do
+      {^port, {:data, {_, [a, b, c, d, e | _] = chunk}}} when [a, b, c, d, e] != 'DBG: ' ->
+        receive_continuation(port, remaining - length(chunk), [response, chunk])
+
+      {^port, {:data, {_, chunk}}} when length(chunk) < 5 ->
+        receive_continuation(port, remaining - length(chunk), [response, chunk])
+
+      {^port, {:exit_status, exit_status}} ->
+        raise "blinkchain OS process died with status: #{inspect(exit_status)}"
+    after
+      500 -> raise "timeout waiting for blinkchain OS process to reply"
+    end
+  end
+
   defp notify(nil, _message), do: :ok
   defp notify(pid, message), do: send(pid, message)
 end
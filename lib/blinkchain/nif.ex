@@ -0,0 +1,69 @@
+defmodule Blinkchain.NIF do
+  @moduledoc false
+
+  # In-process alternative to the `blinkchain` Port executable, built from the
+  # same drawing core. The functions below are replaced by the NIF when it's
+  # loaded by `Blinkchain.HAL` with the `:nif` backend.
+
+  alias Blinkchain.{
+    Color,
+    Point
+  }
+
+  def load do
+    path =
+      :blinkchain
+      |> :code.priv_dir()
+      |> Path.join("blinkchain_nif")
+      |> String.to_charlist()
+
+    case :erlang.load_nif(path, 0) do
+      :ok -> :ok
+      # The NIF stays loaded when `Blinkchain.HAL` is restarted.
+      {:error, {:reload, _}} -> :ok
+      {:error, {_reason, message}} -> {:error, to_string(message)}
+    end
+  end
+
+  def call({:set_brightness, channel, brightness}), do: set_brightness(channel, brightness)
+  def call({:set_gamma, channel, gamma}), do: set_gamma(channel, :erlang.list_to_binary(gamma))
+
+  def call({:set_color_temperature, channel, %Color{r: r, g: g, b: b}}),
+    do: set_color_temperature(channel, r, g, b)
+
+  def call({:set_pixel, %Point{x: x, y: y}, %Color{r: r, g: g, b: b, w: w}}), do: set_pixel(x, y, r, g, b, w)
+
+  def call({:fill, %Point{x: x, y: y}, width, height, %Color{r: r, g: g, b: b, w: w}}),
+    do: fill(x, y, width, height, r, g, b, w)
+
+  def call({:copy, %Point{x: xs, y: ys}, %Point{x: xd, y: yd}, width, height}), do: copy(xs, ys, xd, yd, width, height)
+
+  def call({:copy_blit, %Point{x: xs, y: ys}, %Point{x: xd, y: yd}, width, height}),
+    do: copy_blit(xs, ys, xd, yd, width, height)
+
+  def call({:blit, %Point{x: x, y: y}, width, height, data}), do: blit(x, y, width, height, data)
+
+  def call({:read_region, %Point{x: x, y: y}, width, height, format, output}),
+    do: read_region(x, y, width, height, format, if(output, do: :output, else: :canvas))
+
+  def call(:render), do: render()
+
+  # NIF stubs
+
+  def init(_dma_channel, _pin0, _count0, _type0, _pin1, _count1, _type1), do: :erlang.nif_error(:nif_not_loaded)
+  def init_canvas(_width, _height), do: :erlang.nif_error(:nif_not_loaded)
+  def init_pixels(_channel, _offset, _x, _y, _count, _dx, _dy), do: :erlang.nif_error(:nif_not_loaded)
+  def set_invert(_channel, _invert), do: :erlang.nif_error(:nif_not_loaded)
+  def set_brightness(_channel, _brightness), do: :erlang.nif_error(:nif_not_loaded)
+  def set_gamma(_channel, _gamma), do: :erlang.nif_error(:nif_not_loaded)
+  def set_color_temperature(_channel, _r, _g, _b), do: :erlang.nif_error(:nif_not_loaded)
+  def set_white_extraction(_channel, _enable), do: :erlang.nif_error(:nif_not_loaded)
+  def set_dither(_channel, _enable), do: :erlang.nif_error(:nif_not_loaded)
+  def set_pixel(_x, _y, _r, _g, _b, _w), do: :erlang.nif_error(:nif_not_loaded)
+  def fill(_x, _y, _width, _height, _r, _g, _b, _w), do: :erlang.nif_error(:nif_not_loaded)
+  def copy(_xs, _ys, _xd, _yd, _width, _height), do: :erlang.nif_error(:nif_not_loaded)
+  def copy_blit(_xs, _ys, _xd, _yd, _width, _height), do: :erlang.nif_error(:nif_not_loaded)
+  def blit(_x, _y, _width, _height, _data), do: :erlang.nif_error(:nif_not_loaded)
+  def read_region(_x, _y, _width, _height, _format, _source), do: :erlang.nif_error(:nif_not_loaded)
+  def render, do: :erlang.nif_error(:nif_not_loaded)
+end
@@ -8,49 +8,24 @@
 
 #include "rpi_ws281x/ws2811.h"
 #include "base64.h"
+#include "canvas.h"
+#include "color_stage.h"
 #include "port_interface.h"
 
-typedef struct {
-  uint16_t width;
-  uint16_t height;
-  uint16_t *topology;
-} canvas_t;
-
-int32_t min(int32_t a, int32_t b) {
-  return (a < b) ? a : b;
-}
-
-int32_t max(int32_t a, int32_t b) {
-  return (a > b) ? a : b;
+// Parse a strip type from the command line, exiting if it's invalid.
+int parse_strip_type_arg(char *strip_type) {
+  int result = parse_strip_type(strip_type);
+  if (result < 0)
+    errx(EXIT_FAILURE, "Invalid strip type %s\n", strip_type);
+  return result;
 }
 
-int parse_strip_type(char *strip_type) {
-  if (!strncasecmp("rgb", strip_type, 4))
-    return WS2811_STRIP_RGB;
-  else if (!strncasecmp("rbg", strip_type, 4))
-    return WS2811_STRIP_RBG;
-  else if (!strncasecmp("grb", strip_type, 4))
-    return WS2811_STRIP_GRB;
-  else if (!strncasecmp("gbr", strip_type, 4))
-    return WS2811_STRIP_GBR;
-  else if (!strncasecmp("brg", strip_type, 4))
-    return WS2811_STRIP_BRG;
-  else if (!strncasecmp("bgr", strip_type, 4))
-    return WS2811_STRIP_BGR;
-  else if (!strncasecmp("rgbw", strip_type, 4))
-    return SK6812_STRIP_RGBW;
-  else if (!strncasecmp("rbgw", strip_type, 4))
-    return SK6812_STRIP_RBGW;
-  else if (!strncasecmp("grbw", strip_type, 4))
-    return SK6812_STRIP_GRBW;
-  else if (!strncasecmp("gbrw", strip_type, 4))
-    return SK6812_STRIP_GBRW;
-  else if (!strncasecmp("brgw", strip_type, 4))
-    return SK6812_STRIP_BRGW;
-  else if (!strncasecmp("bgrw", strip_type, 4))
-    return SK6812_STRIP_BGRW;
+// Reply with the error message returned from the drawing core, if any.
+void reply(const char *error) {
+  if (error != NULL)
+    reply_error("%s", error);
   else
-    errx(EXIT_FAILURE, "Invalid strip type %s\n", strip_type);
+    reply_ok();
 }
 
 void init_canvas(canvas_t *canvas) {
@@ -61,15 +36,7 @@ void init_canvas(canvas_t *canvas) {
     return;
   }
   debug("Called init_canvas(width: %hu, height: %hu)", width, height);
-  canvas->width = width;
-  canvas->height = height;
-  if (canvas->topology != NULL) {
-    free(canvas->topology);
-  }
-  canvas->topology = malloc(width * height * sizeof(uint16_t));
-  // Initialize all offsets to USHRT_MAX
-  memset(canvas->topology, 0xFF, width * height * sizeof(uint16_t));
-  reply_ok();
+  reply(canvas_init(canvas, width, height));
 }
 
 void init_pixels(canvas_t *canvas) {
@@ -79,27 +46,10 @@ void init_pixels(canvas_t *canvas) {
   char nl;
   if (scanf("%hhu %hu %hu %hu %hu %hhi %hhi%c", &channel, &offset, &x, &y, &count, &dx, &dy, &nl) != 8 || nl != '\n') {
     reply_error("Argument error");
-  }
-  debug("Called init_pixels(channel: %hhu, offset: %hu, x: %hu, y: %hu, count: %hu, dx: %hhi, dy: %hhi)", channel, offset, x, y, count, dx, dy);
-  if (offset + count - 1 >= 32767) { // 0xEFFF
-    reply_error("The offset of the last pixel in each channel must be less than 32767.");
     return;
   }
-  if (min(x, x + (count - 1) * dx) < 0 || max(x, x + (count - 1) * dx) >= canvas->width ||
-      min(y, y + (count - 1) * dy) < 0 || max(y, y + (count - 1) * dy) >= canvas->height) {
-    reply_error("Pixels must all be within the bounds of the canvas");
-    return;
-  }
-  // MSB designates which channel to use
-  offset |= (channel << 15);
-  uint16_t i;
-  for (i = 0; i < count; i++) {
-    debug("  Setting topology(%hu, %hu) to %hu", x, y, offset);
-    canvas->topology[(canvas->width * y) + x] = offset++;
-    x += dx;
-    y += dy;
-  }
-  reply_ok();
+  debug("Called init_pixels(channel: %hhu, offset: %hu, x: %hu, y: %hu, count: %hu, dx: %hhi, dy: %hhi)", channel, offset, x, y, count, dx, dy);
+  reply(canvas_init_pixels(canvas, channel, offset, x, y, count, dx, dy));
 }
 
 void set_invert(ws2811_channel_t *channels) {
@@ -122,7 +72,7 @@ void set_invert(ws2811_channel_t *channels) {
   reply_ok();
 }
 
-void set_brightness(ws2811_channel_t *channels) {
+void set_brightness(color_stage_t *stages) {
   uint8_t channel, brightness;
   char nl;
   if (scanf("%hhu %hhu%c", &channel, &brightness, &nl) != 3 || nl != '\n') {
@@ -134,72 +84,100 @@ void set_brightness(ws2811_channel_t *channels) {
     return;
   }
   debug("Called set_brightness(channel: %hhu, brightness: %hhu)", channel, brightness);
-  channels[channel].brightness = brightness;
+  stages[channel].brightness = brightness;
+  color_stage_update(&stages[channel]);
   reply_ok();
 }
 
-void set_gamma(ws2811_channel_t *channels) {
+void set_gamma(color_stage_t *stages) {
   uint8_t channel;
-  uint32_t base64_size = 256 * 4 * 4 / 3; // Each color channel has 256 bytes, scaled by 4/3 for Base64
+  uint32_t base64_size = (256 + 2) / 3 * 4; // The gamma table has 256 bytes, scaled by 4/3 (with padding) for Base64
   char *base64_buffer = malloc(base64_size + 1);
   char format[16], nl;
   sprintf(format, "%%hhu %%%us%%c", base64_size);
   if (scanf(format, &channel, base64_buffer, &nl) != 3 || nl != '\n') {
+    free(base64_buffer);
     reply_error("Argument error");
     return;
   }
   int decoded_size;
   uint8_t *data = unbase64(base64_buffer, strlen(base64_buffer), &decoded_size);
   free(base64_buffer);
-  if (decoded_size != 4 * 256) {
-    reply_error("Size of gamma table must be 4 * 256 bytes");
+  if (decoded_size != 256) {
+    reply_error("Size of gamma table must be 256 bytes");
   }
   else if (channel > 1) {
     reply_error("Channel must be 0 or 1");
   }
   else {
     debug("Called set_gamma(channel: %hhu, gamma: <binary>)", channel);
-    channels[channel].gamma = data;
+    memcpy(stages[channel].gamma, data, 256);
+    color_stage_update(&stages[channel]);
     reply_ok();
   }
   free(data);
 }
 
-ws2811_led_t read_pixel(uint16_t x, uint16_t y, ws2811_channel_t *channels, const canvas_t *canvas) {
-  uint16_t offset = canvas->topology[(canvas->width * y) + x];
-  ws2811_led_t color;
-  // Ignore canvas locations that weren't initialized with pixels
-  if (offset == USHRT_MAX) {
-    // TODO: We should probably store the whole canvas instead of just the
-    // actually-mapped pixels in the topology so we don't have to do this...
-    // and maybe use OpenGL ES or something to do the low-level drawing.
-    color = (ws2811_led_t) 0x00000000;
-  } else {
-    // MSB designates which channel to use
-    uint8_t channel = offset >> 15;
-    // Clear the MSB so we can use pixel as the offset within the channel
-    offset &= ~(1 << 15);
-    color = channels[channel].leds[offset];
+void set_color_temperature(color_stage_t *stages) {
+  uint8_t channel, r, g, b;
+  char nl;
+  if (scanf("%hhu %hhu %hhu %hhu%c", &channel, &r, &g, &b, &nl) != 5 || nl != '\n') {
+    reply_error("Argument error");
+    return;
+  }
+  if(channel > 1) {
+    reply_error("Channel must be 0 or 1");
+    return;
   }
-  debug("  - read_pixel(x: %hu, y: %hu) => 0x%08x", x, y, color);
-  return color;
+  debug("Called set_color_temperature(channel: %hhu, r: %hhu, g: %hhu, b: %hhu)", channel, r, g, b);
+  stages[channel].temperature[COMPONENT_R] = r;
+  stages[channel].temperature[COMPONENT_G] = g;
+  stages[channel].temperature[COMPONENT_B] = b;
+  color_stage_update(&stages[channel]);
+  reply_ok();
+}
 
+void set_white_extraction(color_stage_t *stages) {
+  uint8_t channel, enable;
+  char nl;
+  if (scanf("%hhu %hhu%c", &channel, &enable, &nl) != 3 || nl != '\n') {
+    reply_error("Argument error");
+    return;
+  }
+  debug("Called set_white_extraction(channel: %hhu, enable: %hhu)", channel, enable);
+  if(channel > 1) {
+    reply_error("Channel must be 0 or 1");
+    return;
+  }
+  if(enable > 1) {
+    reply_error("Enable must be 0 or 1");
+    return;
+  }
+  stages[channel].white_extraction = enable;
+  reply_ok();
 }
 
-void write_pixel(uint16_t x, uint16_t y, ws2811_led_t color, ws2811_channel_t *channels, const canvas_t *canvas) {
-  debug("  - write_pixel(x: %hu, y: %hu, color: 0x%08x)", x, y, color);
-  uint16_t offset = canvas->topology[(canvas->width * y) + x];
-  // Ignore canvas locations that weren't initialized with pixels
-  if (offset != USHRT_MAX) {
-    // MSB designates which channel to use
-    uint8_t channel = offset >> 15;
-    // Clear the MSB so we can use pixel as the offset within the channel
-    offset &= ~(1 << 15);
-    channels[channel].leds[offset] = color;
+void set_dither(color_stage_t *stages) {
+  uint8_t channel, enable;
+  char nl;
+  if (scanf("%hhu %hhu%c", &channel, &enable, &nl) != 3 || nl != '\n') {
+    reply_error("Argument error");
+    return;
   }
+  debug("Called set_dither(channel: %hhu, enable: %hhu)", channel, enable);
+  if(channel > 1) {
+    reply_error("Channel must be 0 or 1");
+    return;
+  }
+  if(enable > 1) {
+    reply_error("Enable must be 0 or 1");
+    return;
+  }
+  stages[channel].dither = enable;
+  reply_ok();
 }
 
-void get_pixel(ws2811_channel_t *channels, const canvas_t *canvas) {
+void get_pixel(const canvas_t *canvas) {
   uint16_t x, y;
   char nl;
   if (scanf("%hu %hu%c", &x, &y, &nl) != 3 || nl != '\n') {
@@ -207,14 +185,63 @@ void get_pixel(ws2811_channel_t *channels, const canvas_t *canvas) {
     return;
   }
   debug("Called get_pixel(x: %hu, y: %hu)", x, y);
-  if (x + 1 > canvas->width || y + 1 > canvas->height) {
-    reply_error("Cannot read from outside canvas dimensions");
+  ws2811_led_t color;
+  const char *error = canvas_get_pixel(canvas, x, y, &color);
+  if (error != NULL)
+    reply_error("%s", error);
+  else
+    reply_ok_payload("0x%08x", color);
+}
+
+void read_region(const ws2811_channel_t *channels, const canvas_t *canvas) {
+  uint16_t x, y, width, height;
+  char format[8], source[8], nl;
+  if (scanf("%hu %hu %hu %hu %7s %7s%c", &x, &y, &width, &height, format, source, &nl) != 7 || nl != '\n') {
+    reply_error("Argument error");
     return;
   }
-  reply_ok_payload("0x%08x", read_pixel(x, y, channels, canvas));
+  debug("Called read_region(x: %hu, y: %hu, width: %hu, height: %hu, format: %s, source: %s)", x, y, width, height, format, source);
+  uint8_t shifts[4];
+  uint8_t bytes_per_pixel = parse_pixel_format(format, shifts);
+  if (bytes_per_pixel == 0) {
+    reply_error("Pixel format must be an ordering of rgb or rgbw");
+    return;
+  }
+  bool output;
+  if (strcasecmp(source, "canvas") == 0) {
+    output = false;
+  } else if (strcasecmp(source, "output") == 0) {
+    output = true;
+  } else {
+    reply_error("Source must be canvas or output");
+    return;
+  }
+  const char *error = canvas_check_region(canvas, x, y, width, height);
+  if (error != NULL) {
+    reply_error("%s", error);
+    return;
+  }
+  size_t size = (size_t) width * height * bytes_per_pixel;
+  uint8_t *data = malloc(size);
+  if (data == NULL && size > 0) {
+    reply_error("Unable to allocate memory for the region");
+    return;
+  }
+  canvas_read_region(canvas, channels, x, y, width, height, shifts, bytes_per_pixel, output, data);
+  int encoded_size;
+  char *base64_data = base64(data, size, &encoded_size);
+  free(data);
+  if (base64_data == NULL) {
+    reply_error("Unable to allocate memory for the region");
+    return;
+  }
+  // The length lets the HAL reassemble replies that are longer than its line
+  // length from among any debug output.
+  reply_ok_payload("%d %s", encoded_size, base64_data);
+  free(base64_data);
 }
 
-void set_pixel(ws2811_channel_t *channels, const canvas_t *canvas) {
+void set_pixel(const canvas_t *canvas) {
   uint16_t x, y;
   uint8_t r, g, b, w;
   char nl;
@@ -225,15 +252,10 @@ void set_pixel(ws2811_channel_t *channels, const canvas_t *canvas) {
   // ws2811_led_t is uint32_t: 0xWWRRGGBB
   ws2811_led_t color = (w << 24) | (r << 16) | (g << 8) | b;
   debug("Called set_pixel(x: %hu, y: %hu, color: 0x%08x)", x, y, color);
-  if (x + 1 > canvas->width || y + 1 > canvas->height) {
-    reply_error("Cannot draw outside canvas dimensions");
-    return;
-  }
-  write_pixel(x, y, color, channels, canvas);
-  reply_ok();
+  reply(canvas_set_pixel(canvas, x, y, color));
 }
 
-void fill(ws2811_channel_t *channels, const canvas_t *canvas) {
+void fill(const canvas_t *canvas) {
   uint16_t x, y, width, height;
   uint8_t r, g, b, w;
   char nl;
@@ -244,20 +266,10 @@ void fill(ws2811_channel_t *channels, const canvas_t *canvas) {
   // ws2811_led_t is uint32_t: 0xWWRRGGBB
   ws2811_led_t color = (w << 24) | (r << 16) | (g << 8) | b;
   debug("Called fill(x: %hu, y: %hu, width: %hu, height: %hu, color: 0x%08x)", x, y, width, height, color);
-  if (x + width > canvas->width || y + height > canvas->height) {
-    reply_error("Cannot draw outside canvas dimensions");
-    return;
-  }
-  uint16_t row, col;
-  for(row = 0; row < height; row++) {
-    for(col = 0; col < width; col++) {
-      write_pixel(x + col, y + row, color, channels, canvas);
-    }
-  }
-  reply_ok();
+  reply(canvas_fill(canvas, x, y, width, height, color));
 }
 
-void copy(bool copy_null, ws2811_channel_t *channels, const canvas_t *canvas) {
+void copy(bool copy_null, const canvas_t *canvas) {
   uint16_t xs, ys, xd, yd, width, height;
   char nl;
   if (scanf("%hu %hu %hu %hu %hu %hu%c", &xs, &ys, &xd, &yd, &width, &height, &nl) != 7 || nl != '\n') {
@@ -265,30 +277,10 @@ void copy(bool copy_null, ws2811_channel_t *channels, const canvas_t *canvas) {
     return;
   }
   debug("Called copy%s(xs: %hu, ys: %hu, xd: %hu, yd: %hu, width: %hu, height: %hu)", copy_null ? "" : "_blit", xs, ys, xd, yd, width, height);
-  if (xs + width > canvas->width || ys + height > canvas->height || xd + width > canvas->width || yd + height > canvas->height) {
-    reply_error("Cannot draw outside canvas dimensions");
-    return;
-  }
-  uint16_t row, col;
-  ws2811_led_t *buffer = calloc(width * height, sizeof(ws2811_led_t));;
-  for(row = 0; row < height; row++) {
-    for(col = 0; col < width; col++) {
-      buffer[row * width + col] = read_pixel(xs + col, ys + row, channels, canvas);
-    }
-  }
-  // We have to copy to a temporary buffer and then back so that the copy happens "all at once."
-  ws2811_led_t color;
-  for(row = 0; row < height; row++) {
-    for(col = 0; col < width; col++) {
-      color = buffer[row * width + col];
-      if (color != 0x00000000 || copy_null)
-        write_pixel(xd + col, yd + row, color, channels, canvas);
-    }
-  }
-  reply_ok();
+  reply(canvas_copy(canvas, copy_null, xs, ys, xd, yd, width, height));
 }
 
-void blit(ws2811_channel_t *channels, const canvas_t *canvas) {
+void blit(const canvas_t *canvas) {
   uint16_t x, y, width, height;
   uint32_t base64_size;
   if (scanf("%hu %hu %hu %hu %u ", &x, &y, &width, &height, &base64_size) != 5) {
@@ -308,28 +300,7 @@ void blit(ws2811_channel_t *channels, const canvas_t *canvas) {
   int decoded_size;
   uint8_t *data = unbase64(base64_buffer, strlen(base64_buffer), &decoded_size);
   free(base64_buffer);
-  // Each pixel should have 4 8-bit color channels
-  if (decoded_size != width * height * 4) {
-    reply_error("Size of binary data didn't match the width and height");
-  }
-  else if (x + width > canvas->width || y + height > canvas->height) {
-    reply_error("Cannot draw outside canvas dimensions");
-  }
-  else {
-    uint16_t row, col, offset = 0;
-    ws2811_led_t color;
-    for(row = 0; row < height; row++) {
-      for(col = 0; col < width; col++, offset += 4) {
-        // ws2811_led_t is uint32_t: 0xWWRRGGBB
-        // so data should look like [0xWW, 0xRR, 0xGG, 0xBB]
-        color = data[offset] << 24 | data[offset + 1] << 16 | data[offset + 2] << 8 | data[offset + 3];
-        // Ignore totally black pixels in the source image to allow simple sprite masking.
-        if (color != 0x00000000)
-          write_pixel(x + col, y + row, color, channels, canvas);
-      }
-    }
-    reply_ok();
-  }
+  reply(canvas_blit(canvas, x, y, width, height, data, decoded_size));
   free(data);
 }
 
@@ -340,7 +311,7 @@ int main(int argc, char *argv[]) {
   uint8_t dma_channel = atoi(argv[1]);
   uint8_t gpio_pin1 = atoi(argv[2]);
   uint32_t led_count1 = strtol(argv[3], NULL, 10);
-  int strip_type1 = parse_strip_type(argv[4]);
+  int strip_type1 = parse_strip_type_arg(argv[4]);
 
   uint8_t gpio_pin2 = 0;
   uint32_t led_count2 = 0;
@@ -348,7 +319,7 @@ int main(int argc, char *argv[]) {
   if (argc == 8) {
     gpio_pin2 = atoi(argv[5]);
     led_count2 = strtol(argv[6], NULL, 10);
-    strip_type2 = parse_strip_type(argv[7]);
+    strip_type2 = parse_strip_type_arg(argv[7]);
   }
 
   /*
@@ -379,16 +350,26 @@ int main(int argc, char *argv[]) {
   if (rc != WS2811_SUCCESS)
     errx(EXIT_FAILURE, "ws2811_init failed: %d (%s)", rc, ws2811_get_return_t_str(rc));
 
+  // Color correction is done by our own color stage when gathering the canvas
+  // into the LED buffers, so ws2811_render is left with its default linear
+  // gamma and full brightness.
+  color_stage_t stages[RPI_PWM_CHANNELS];
+  if (!color_stage_init(&stages[0], led_count1) || !color_stage_init(&stages[1], led_count2))
+    errx(EXIT_FAILURE, "Unable to allocate memory for the color stages");
+
   canvas_t canvas = {
     .width = 0,
     .height = 0,
     .topology = NULL,
   };
+  const char *error = canvas_init_channels(&canvas, led_count1, led_count2);
+  if (error != NULL)
+    errx(EXIT_FAILURE, "%s", error);
 
-  char buffer[16];
+  char buffer[32];
   for (;;) {
     buffer[0] = '\0';
-    if (scanf("%15s", buffer) == 0 || strlen(buffer) == 0) {
+    if (scanf("%31s", buffer) == 0 || strlen(buffer) == 0) {
       if (feof(stdin)) {
         debug("EOF");
         exit(EXIT_SUCCESS);
@@ -407,30 +388,43 @@ int main(int argc, char *argv[]) {
       set_invert(ledstring.channel);
 
     } else if (strcasecmp(buffer, "set_brightness") == 0) {
-      set_brightness(ledstring.channel);
+      set_brightness(stages);
 
     } else if (strcasecmp(buffer, "set_gamma") == 0) {
-      set_gamma(ledstring.channel);
+      set_gamma(stages);
+
+    } else if (strcasecmp(buffer, "set_color_temperature") == 0) {
+      set_color_temperature(stages);
+
+    } else if (strcasecmp(buffer, "set_white_extraction") == 0) {
+      set_white_extraction(stages);
+
+    } else if (strcasecmp(buffer, "set_dither") == 0) {
+      set_dither(stages);
 
     } else if (strcasecmp(buffer, "set_pixel") == 0) {
-      set_pixel(ledstring.channel, &canvas);
+      set_pixel(&canvas);
 
     } else if (strcasecmp(buffer, "get_pixel") == 0) {
-      get_pixel(ledstring.channel, &canvas);
+      get_pixel(&canvas);
+
+    } else if (strcasecmp(buffer, "read_region") == 0) {
+      read_region(ledstring.channel, &canvas);
 
     } else if (strcasecmp(buffer, "fill") == 0) {
-      fill(ledstring.channel, &canvas);
+      fill(&canvas);
 
     } else if (strcasecmp(buffer, "copy") == 0) {
-      copy(true, ledstring.channel, &canvas);
+      copy(true, &canvas);
 
     } else if (strcasecmp(buffer, "blit") == 0) {
-      blit(ledstring.channel, &canvas);
+      blit(&canvas);
 
     } else if (strcasecmp(buffer, "copy_blit") == 0) {
-      copy(false, ledstring.channel, &canvas);
+      copy(false, &canvas);
 
     } else if (strcasecmp(buffer, "render") == 0) {
+      canvas_gather(&canvas, stages, &ledstring);
       ws2811_return_t result = ws2811_render(&ledstring);
       if (result != WS2811_SUCCESS)
         errx(EXIT_FAILURE, "ws2811_render failed: %d (%s)", result, ws2811_get_return_t_str(result));
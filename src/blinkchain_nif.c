@@ -0,0 +1,467 @@
+// In-process NIF front-end for the drawing core, as an alternative to the
+// `blinkchain` Port executable. Drawing calls run directly on the calling
+// process's scheduler and work on Erlang binaries in place, while init and
+// render run on a dirty I/O scheduler because they wait on the DMA hardware.
+// Drawing calls on large regions are moved to a dirty CPU scheduler.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <erl_nif.h>
+
+#include "rpi_ws281x/ws2811.h"
+#include "canvas.h"
+#include "color_stage.h"
+
+typedef struct {
+  // Protects the canvas and color stages
+  ErlNifMutex *lock;
+  // Protects the LED buffers and channel settings used by ws2811_render, so
+  // that drawing can continue while a frame is being sent to the LEDs.
+  ErlNifMutex *render_lock;
+  bool initialized;
+  ws2811_t ledstring;
+  color_stage_t stages[RPI_PWM_CHANNELS];
+  canvas_t canvas;
+} blinkchain_t;
+
+static ERL_NIF_TERM atom_ok;
+static ERL_NIF_TERM atom_error;
+static ERL_NIF_TERM atom_canvas;
+static ERL_NIF_TERM atom_output;
+
+static ERL_NIF_TERM make_error(ErlNifEnv *env, const char *message) {
+  ERL_NIF_TERM reason;
+  size_t length = strlen(message);
+  memcpy(enif_make_new_binary(env, length, &reason), message, length);
+  return enif_make_tuple2(env, atom_error, reason);
+}
+
+// Reply with the error message returned from the drawing core, if any.
+static ERL_NIF_TERM reply(ErlNifEnv *env, const char *error) {
+  return (error != NULL) ? make_error(env, error) : atom_ok;
+}
+
+static bool get_uint8(ErlNifEnv *env, ERL_NIF_TERM term, uint8_t *value) {
+  unsigned int result;
+  if (!enif_get_uint(env, term, &result) || result > UINT8_MAX)
+    return false;
+  *value = result;
+  return true;
+}
+
+static bool get_int8(ErlNifEnv *env, ERL_NIF_TERM term, int8_t *value) {
+  int result;
+  if (!enif_get_int(env, term, &result) || result < INT8_MIN || result > INT8_MAX)
+    return false;
+  *value = result;
+  return true;
+}
+
+static bool get_uint16(ErlNifEnv *env, ERL_NIF_TERM term, uint16_t *value) {
+  unsigned int result;
+  if (!enif_get_uint(env, term, &result) || result > UINT16_MAX)
+    return false;
+  *value = result;
+  return true;
+}
+
+static bool get_channel(ErlNifEnv *env, ERL_NIF_TERM term, uint8_t *channel) {
+  return get_uint8(env, term, channel) && *channel < RPI_PWM_CHANNELS;
+}
+
+static bool get_flag(ErlNifEnv *env, ERL_NIF_TERM term, uint8_t *flag) {
+  return get_uint8(env, term, flag) && *flag <= 1;
+}
+
+static bool get_strip_type(ErlNifEnv *env, ERL_NIF_TERM term, int *strip_type) {
+  char buffer[8];
+  if (enif_get_atom(env, term, buffer, sizeof(buffer), ERL_NIF_LATIN1) <= 0)
+    return false;
+  *strip_type = parse_strip_type(buffer);
+  return *strip_type >= 0;
+}
+
+static bool get_color(ErlNifEnv *env, const ERL_NIF_TERM argv[], ws2811_led_t *color) {
+  uint8_t r, g, b, w;
+  if (!get_uint8(env, argv[0], &r) || !get_uint8(env, argv[1], &g) ||
+      !get_uint8(env, argv[2], &b) || !get_uint8(env, argv[3], &w))
+    return false;
+  // ws2811_led_t is uint32_t: 0xWWRRGGBB
+  *color = (w << 24) | (r << 16) | (g << 8) | b;
+  return true;
+}
+
+static void release(blinkchain_t *blinkchain) {
+  uint8_t ch;
+  if (!blinkchain->initialized)
+    return;
+  ws2811_fini(&blinkchain->ledstring);
+  for (ch = 0; ch < RPI_PWM_CHANNELS; ch++)
+    color_stage_free(&blinkchain->stages[ch]);
+  canvas_free(&blinkchain->canvas);
+  blinkchain->initialized = false;
+}
+
+// Take the given lock and make sure that init has succeeded. `initialized`
+// only changes while both locks are held, so either one protects it.
+#define LOCK_INITIALIZED(env, blinkchain, mutex) \
+  enif_mutex_lock(mutex); \
+  if (!blinkchain->initialized) { \
+    enif_mutex_unlock(mutex); \
+    return make_error(env, "Blinkchain has not been initialized"); \
+  }
+
+// Regions with more pixels than this are drawn on a dirty CPU scheduler, so
+// that they don't hold up a normal scheduler for more than about a millisecond.
+#define MAX_NORMAL_PIXELS 16384
+
+static bool should_run_dirty(uint16_t width, uint16_t height) {
+  return (uint32_t) width * height > MAX_NORMAL_PIXELS &&
+    enif_thread_type() == ERL_NIF_THR_NORMAL_SCHEDULER;
+}
+
+static ERL_NIF_TERM init_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  blinkchain_t *blinkchain = enif_priv_data(env);
+  uint8_t dma_channel, gpio_pin1, gpio_pin2;
+  unsigned int led_count1, led_count2;
+  int strip_type1, strip_type2;
+  if (!get_uint8(env, argv[0], &dma_channel) ||
+      !get_uint8(env, argv[1], &gpio_pin1) || !enif_get_uint(env, argv[2], &led_count1) ||
+      !get_strip_type(env, argv[3], &strip_type1) ||
+      !get_uint8(env, argv[4], &gpio_pin2) || !enif_get_uint(env, argv[5], &led_count2) ||
+      !get_strip_type(env, argv[6], &strip_type2))
+    return enif_make_badarg(env);
+
+  enif_mutex_lock(blinkchain->render_lock);
+  enif_mutex_lock(blinkchain->lock);
+  // Start over if the HAL has been restarted
+  release(blinkchain);
+
+  ws2811_t ledstring = {
+    .freq = WS2811_TARGET_FREQ,
+    .dmanum = dma_channel,
+    .channel = {
+      [0] = {
+        .gpionum = gpio_pin1,
+        .count = led_count1,
+        .invert = 0,
+        .brightness = 255,
+        .strip_type = strip_type1,
+      },
+      [1] = {
+        .gpionum = gpio_pin2,
+        .count = led_count2,
+        .invert = 0,
+        .brightness = 255,
+        .strip_type = strip_type2,
+      },
+    },
+  };
+  blinkchain->ledstring = ledstring;
+
+  ERL_NIF_TERM result = atom_ok;
+  ws2811_return_t rc = ws2811_init(&blinkchain->ledstring);
+  if (rc != WS2811_SUCCESS) {
+    result = make_error(env, ws2811_get_return_t_str(rc));
+  } else {
+    canvas_t canvas = {
+      .width = 0,
+      .height = 0,
+      .topology = NULL,
+    };
+    blinkchain->canvas = canvas;
+    const char *error = canvas_init_channels(&blinkchain->canvas, led_count1, led_count2);
+    if (!color_stage_init(&blinkchain->stages[0], led_count1) ||
+        !color_stage_init(&blinkchain->stages[1], led_count2))
+      error = "Unable to allocate memory for the color stages";
+    // release() cleans up after a successful init, so set initialized first
+    blinkchain->initialized = true;
+    if (error != NULL) {
+      release(blinkchain);
+      result = make_error(env, error);
+    }
+  }
+  enif_mutex_unlock(blinkchain->lock);
+  enif_mutex_unlock(blinkchain->render_lock);
+  return result;
+}
+
+static ERL_NIF_TERM init_canvas_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  blinkchain_t *blinkchain = enif_priv_data(env);
+  uint16_t width, height;
+  if (!get_uint16(env, argv[0], &width) || !get_uint16(env, argv[1], &height))
+    return enif_make_badarg(env);
+  if (should_run_dirty(width, height))
+    return enif_schedule_nif(env, "init_canvas", ERL_NIF_DIRTY_JOB_CPU_BOUND, init_canvas_nif, argc, argv);
+  LOCK_INITIALIZED(env, blinkchain, blinkchain->lock);
+  const char *error = canvas_init(&blinkchain->canvas, width, height);
+  enif_mutex_unlock(blinkchain->lock);
+  return reply(env, error);
+}
+
+static ERL_NIF_TERM init_pixels_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  blinkchain_t *blinkchain = enif_priv_data(env);
+  uint16_t x, y, count, offset;
+  uint8_t channel;
+  int8_t dx, dy;
+  if (!get_channel(env, argv[0], &channel) || !get_uint16(env, argv[1], &offset) ||
+      !get_uint16(env, argv[2], &x) || !get_uint16(env, argv[3], &y) || !get_uint16(env, argv[4], &count) ||
+      !get_int8(env, argv[5], &dx) || !get_int8(env, argv[6], &dy))
+    return enif_make_badarg(env);
+  LOCK_INITIALIZED(env, blinkchain, blinkchain->lock);
+  const char *error = canvas_init_pixels(&blinkchain->canvas, channel, offset, x, y, count, dx, dy);
+  enif_mutex_unlock(blinkchain->lock);
+  return reply(env, error);
+}
+
+static ERL_NIF_TERM set_invert_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  blinkchain_t *blinkchain = enif_priv_data(env);
+  uint8_t channel, invert;
+  if (!get_channel(env, argv[0], &channel) || !get_flag(env, argv[1], &invert))
+    return enif_make_badarg(env);
+  LOCK_INITIALIZED(env, blinkchain, blinkchain->render_lock);
+  blinkchain->ledstring.channel[channel].invert = invert;
+  enif_mutex_unlock(blinkchain->render_lock);
+  return atom_ok;
+}
+
+static ERL_NIF_TERM set_brightness_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  blinkchain_t *blinkchain = enif_priv_data(env);
+  uint8_t channel, brightness;
+  if (!get_channel(env, argv[0], &channel) || !get_uint8(env, argv[1], &brightness))
+    return enif_make_badarg(env);
+  LOCK_INITIALIZED(env, blinkchain, blinkchain->lock);
+  blinkchain->stages[channel].brightness = brightness;
+  color_stage_update(&blinkchain->stages[channel]);
+  enif_mutex_unlock(blinkchain->lock);
+  return atom_ok;
+}
+
+static ERL_NIF_TERM set_gamma_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  blinkchain_t *blinkchain = enif_priv_data(env);
+  uint8_t channel;
+  ErlNifBinary gamma;
+  if (!get_channel(env, argv[0], &channel) || !enif_inspect_binary(env, argv[1], &gamma))
+    return enif_make_badarg(env);
+  if (gamma.size != 256)
+    return make_error(env, "Size of gamma table must be 256 bytes");
+  LOCK_INITIALIZED(env, blinkchain, blinkchain->lock);
+  memcpy(blinkchain->stages[channel].gamma, gamma.data, 256);
+  color_stage_update(&blinkchain->stages[channel]);
+  enif_mutex_unlock(blinkchain->lock);
+  return atom_ok;
+}
+
+static ERL_NIF_TERM set_color_temperature_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  blinkchain_t *blinkchain = enif_priv_data(env);
+  uint8_t channel, r, g, b;
+  if (!get_channel(env, argv[0], &channel) || !get_uint8(env, argv[1], &r) ||
+      !get_uint8(env, argv[2], &g) || !get_uint8(env, argv[3], &b))
+    return enif_make_badarg(env);
+  LOCK_INITIALIZED(env, blinkchain, blinkchain->lock);
+  blinkchain->stages[channel].temperature[COMPONENT_R] = r;
+  blinkchain->stages[channel].temperature[COMPONENT_G] = g;
+  blinkchain->stages[channel].temperature[COMPONENT_B] = b;
+  color_stage_update(&blinkchain->stages[channel]);
+  enif_mutex_unlock(blinkchain->lock);
+  return atom_ok;
+}
+
+static ERL_NIF_TERM set_white_extraction_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  blinkchain_t *blinkchain = enif_priv_data(env);
+  uint8_t channel, enable;
+  if (!get_channel(env, argv[0], &channel) || !get_flag(env, argv[1], &enable))
+    return enif_make_badarg(env);
+  LOCK_INITIALIZED(env, blinkchain, blinkchain->lock);
+  blinkchain->stages[channel].white_extraction = enable;
+  enif_mutex_unlock(blinkchain->lock);
+  return atom_ok;
+}
+
+static ERL_NIF_TERM set_dither_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  blinkchain_t *blinkchain = enif_priv_data(env);
+  uint8_t channel, enable;
+  if (!get_channel(env, argv[0], &channel) || !get_flag(env, argv[1], &enable))
+    return enif_make_badarg(env);
+  LOCK_INITIALIZED(env, blinkchain, blinkchain->lock);
+  blinkchain->stages[channel].dither = enable;
+  enif_mutex_unlock(blinkchain->lock);
+  return atom_ok;
+}
+
+static ERL_NIF_TERM set_pixel_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  blinkchain_t *blinkchain = enif_priv_data(env);
+  uint16_t x, y;
+  ws2811_led_t color;
+  if (!get_uint16(env, argv[0], &x) || !get_uint16(env, argv[1], &y) || !get_color(env, &argv[2], &color))
+    return enif_make_badarg(env);
+  LOCK_INITIALIZED(env, blinkchain, blinkchain->lock);
+  const char *error = canvas_set_pixel(&blinkchain->canvas, x, y, color);
+  enif_mutex_unlock(blinkchain->lock);
+  return reply(env, error);
+}
+
+static ERL_NIF_TERM fill_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  blinkchain_t *blinkchain = enif_priv_data(env);
+  uint16_t x, y, width, height;
+  ws2811_led_t color;
+  if (!get_uint16(env, argv[0], &x) || !get_uint16(env, argv[1], &y) ||
+      !get_uint16(env, argv[2], &width) || !get_uint16(env, argv[3], &height) ||
+      !get_color(env, &argv[4], &color))
+    return enif_make_badarg(env);
+  if (should_run_dirty(width, height))
+    return enif_schedule_nif(env, "fill", ERL_NIF_DIRTY_JOB_CPU_BOUND, fill_nif, argc, argv);
+  LOCK_INITIALIZED(env, blinkchain, blinkchain->lock);
+  const char *error = canvas_fill(&blinkchain->canvas, x, y, width, height, color);
+  enif_mutex_unlock(blinkchain->lock);
+  return reply(env, error);
+}
+
+static ERL_NIF_TERM copy_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]);
+static ERL_NIF_TERM copy_blit_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]);
+
+static ERL_NIF_TERM copy(bool copy_null, ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  blinkchain_t *blinkchain = enif_priv_data(env);
+  uint16_t xs, ys, xd, yd, width, height;
+  if (!get_uint16(env, argv[0], &xs) || !get_uint16(env, argv[1], &ys) ||
+      !get_uint16(env, argv[2], &xd) || !get_uint16(env, argv[3], &yd) ||
+      !get_uint16(env, argv[4], &width) || !get_uint16(env, argv[5], &height))
+    return enif_make_badarg(env);
+  if (should_run_dirty(width, height)) {
+    if (copy_null)
+      return enif_schedule_nif(env, "copy", ERL_NIF_DIRTY_JOB_CPU_BOUND, copy_nif, argc, argv);
+    else
+      return enif_schedule_nif(env, "copy_blit", ERL_NIF_DIRTY_JOB_CPU_BOUND, copy_blit_nif, argc, argv);
+  }
+  LOCK_INITIALIZED(env, blinkchain, blinkchain->lock);
+  const char *error = canvas_copy(&blinkchain->canvas, copy_null, xs, ys, xd, yd, width, height);
+  enif_mutex_unlock(blinkchain->lock);
+  return reply(env, error);
+}
+
+static ERL_NIF_TERM copy_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  return copy(true, env, argc, argv);
+}
+
+static ERL_NIF_TERM copy_blit_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  return copy(false, env, argc, argv);
+}
+
+static ERL_NIF_TERM blit_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  blinkchain_t *blinkchain = enif_priv_data(env);
+  uint16_t x, y, width, height;
+  ErlNifBinary data;
+  if (!get_uint16(env, argv[0], &x) || !get_uint16(env, argv[1], &y) ||
+      !get_uint16(env, argv[2], &width) || !get_uint16(env, argv[3], &height) ||
+      !enif_inspect_binary(env, argv[4], &data))
+    return enif_make_badarg(env);
+  if (should_run_dirty(width, height))
+    return enif_schedule_nif(env, "blit", ERL_NIF_DIRTY_JOB_CPU_BOUND, blit_nif, argc, argv);
+  // The pixel data is read straight out of the binary, without copying it
+  LOCK_INITIALIZED(env, blinkchain, blinkchain->lock);
+  const char *error = canvas_blit(&blinkchain->canvas, x, y, width, height, data.data, data.size);
+  enif_mutex_unlock(blinkchain->lock);
+  return reply(env, error);
+}
+
+static ERL_NIF_TERM read_region_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  blinkchain_t *blinkchain = enif_priv_data(env);
+  uint16_t x, y, width, height;
+  char format[8];
+  if (!get_uint16(env, argv[0], &x) || !get_uint16(env, argv[1], &y) ||
+      !get_uint16(env, argv[2], &width) || !get_uint16(env, argv[3], &height) ||
+      enif_get_atom(env, argv[4], format, sizeof(format), ERL_NIF_LATIN1) <= 0)
+    return enif_make_badarg(env);
+  uint8_t shifts[4];
+  uint8_t bytes_per_pixel = parse_pixel_format(format, shifts);
+  if (bytes_per_pixel == 0)
+    return make_error(env, "Pixel format must be an ordering of rgb or rgbw");
+  bool output;
+  if (enif_is_identical(argv[5], atom_canvas))
+    output = false;
+  else if (enif_is_identical(argv[5], atom_output))
+    output = true;
+  else
+    return make_error(env, "Source must be canvas or output");
+  if (should_run_dirty(width, height))
+    return enif_schedule_nif(env, "read_region", ERL_NIF_DIRTY_JOB_CPU_BOUND, read_region_nif, argc, argv);
+
+  // The output is read from the LED buffers, which render_lock protects
+  ErlNifMutex *mutex = output ? blinkchain->render_lock : blinkchain->lock;
+  LOCK_INITIALIZED(env, blinkchain, mutex);
+  if (output)
+    enif_mutex_lock(blinkchain->lock);
+  const char *error = canvas_check_region(&blinkchain->canvas, x, y, width, height);
+  // The pixels are written straight into the binary that's returned
+  ErlNifBinary data;
+  if (error == NULL && !enif_alloc_binary((size_t) width * height * bytes_per_pixel, &data))
+    error = "Unable to allocate memory for the region";
+  if (error == NULL)
+    canvas_read_region(&blinkchain->canvas, blinkchain->ledstring.channel, x, y, width, height, shifts, bytes_per_pixel, output, data.data);
+  if (output)
+    enif_mutex_unlock(blinkchain->lock);
+  enif_mutex_unlock(mutex);
+  if (error != NULL)
+    return make_error(env, error);
+  return enif_make_tuple2(env, atom_ok, enif_make_binary(env, &data));
+}
+
+static ERL_NIF_TERM render_nif(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  blinkchain_t *blinkchain = enif_priv_data(env);
+  LOCK_INITIALIZED(env, blinkchain, blinkchain->render_lock);
+  enif_mutex_lock(blinkchain->lock);
+  canvas_gather(&blinkchain->canvas, blinkchain->stages, &blinkchain->ledstring);
+  enif_mutex_unlock(blinkchain->lock);
+  ws2811_return_t rc = ws2811_render(&blinkchain->ledstring);
+  enif_mutex_unlock(blinkchain->render_lock);
+  if (rc != WS2811_SUCCESS)
+    return make_error(env, ws2811_get_return_t_str(rc));
+  return atom_ok;
+}
+
+static int load(ErlNifEnv *env, void **priv_data, ERL_NIF_TERM load_info) {
+  blinkchain_t *blinkchain = enif_alloc(sizeof(blinkchain_t));
+  if (blinkchain == NULL)
+    return 1;
+  memset(blinkchain, 0, sizeof(blinkchain_t));
+  blinkchain->lock = enif_mutex_create("blinkchain_lock");
+  blinkchain->render_lock = enif_mutex_create("blinkchain_render_lock");
+  atom_ok = enif_make_atom(env, "ok");
+  atom_error = enif_make_atom(env, "error");
+  atom_canvas = enif_make_atom(env, "canvas");
+  atom_output = enif_make_atom(env, "output");
+  *priv_data = blinkchain;
+  return 0;
+}
+
+static void unload(ErlNifEnv *env, void *priv_data) {
+  blinkchain_t *blinkchain = priv_data;
+  release(blinkchain);
+  enif_mutex_destroy(blinkchain->lock);
+  enif_mutex_destroy(blinkchain->render_lock);
+  enif_free(blinkchain);
+}
+
+static ErlNifFunc nif_funcs[] = {
+  {"init", 7, init_nif, ERL_NIF_DIRTY_JOB_IO_BOUND},
+  {"init_canvas", 2, init_canvas_nif, 0},
+  {"init_pixels", 7, init_pixels_nif, 0},
+  {"set_invert", 2, set_invert_nif, 0},
+  {"set_brightness", 2, set_brightness_nif, 0},
+  {"set_gamma", 2, set_gamma_nif, 0},
+  {"set_color_temperature", 4, set_color_temperature_nif, 0},
+  {"set_white_extraction", 2, set_white_extraction_nif, 0},
+  {"set_dither", 2, set_dither_nif, 0},
+  {"set_pixel", 6, set_pixel_nif, 0},
+  {"fill", 8, fill_nif, 0},
+  {"copy", 6, copy_nif, 0},
+  {"copy_blit", 6, copy_blit_nif, 0},
+  {"blit", 5, blit_nif, 0},
+  {"read_region", 6, read_region_nif, 0},
+  {"render", 0, render_nif, ERL_NIF_DIRTY_JOB_IO_BOUND},
+};
+
+ERL_NIF_INIT(Elixir.Blinkchain.NIF, nif_funcs, load, NULL, NULL, unload)
@@ -0,0 +1,314 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "rpi_ws281x/ws2811.h"
+#include "canvas.h"
+#include "color_stage.h"
+#include "debug.h"
+
+static int32_t min(int32_t a, int32_t b) {
+  return (a < b) ? a : b;
+}
+
+static int32_t max(int32_t a, int32_t b) {
+  return (a > b) ? a : b;
+}
+
+// Returns -1 if the strip type is invalid.
+int parse_strip_type(const char *strip_type) {
+  if (!strncasecmp("rgb", strip_type, 4))
+    return WS2811_STRIP_RGB;
+  else if (!strncasecmp("rbg", strip_type, 4))
+    return WS2811_STRIP_RBG;
+  else if (!strncasecmp("grb", strip_type, 4))
+    return WS2811_STRIP_GRB;
+  else if (!strncasecmp("gbr", strip_type, 4))
+    return WS2811_STRIP_GBR;
+  else if (!strncasecmp("brg", strip_type, 4))
+    return WS2811_STRIP_BRG;
+  else if (!strncasecmp("bgr", strip_type, 4))
+    return WS2811_STRIP_BGR;
+  else if (!strncasecmp("rgbw", strip_type, 4))
+    return SK6812_STRIP_RGBW;
+  else if (!strncasecmp("rbgw", strip_type, 4))
+    return SK6812_STRIP_RBGW;
+  else if (!strncasecmp("grbw", strip_type, 4))
+    return SK6812_STRIP_GRBW;
+  else if (!strncasecmp("gbrw", strip_type, 4))
+    return SK6812_STRIP_GBRW;
+  else if (!strncasecmp("brgw", strip_type, 4))
+    return SK6812_STRIP_BRGW;
+  else if (!strncasecmp("bgrw", strip_type, 4))
+    return SK6812_STRIP_BGRW;
+  else
+    return -1;
+}
+
+// Parse a pixel format such as "rgb" or "wrgb" into the bit shift of each
+// color component within a ws2811_led_t (0xWWRRGGBB), in output order.
+// Returns the number of bytes per pixel, or 0 if the format is invalid.
+uint8_t parse_pixel_format(const char *format, uint8_t *shifts) {
+  size_t length = strlen(format);
+  if (length != 3 && length != 4)
+    return 0;
+  uint8_t i, seen = 0;
+  for (i = 0; i < length; i++) {
+    switch (tolower(format[i])) {
+      case 'w': shifts[i] = 24; break;
+      case 'r': shifts[i] = 16; break;
+      case 'g': shifts[i] = 8; break;
+      case 'b': shifts[i] = 0; break;
+      default: return 0;
+    }
+    // Each component may appear only once, and white only in 4-byte formats.
+    if (seen & (1 << (shifts[i] / 8)) || (length == 3 && shifts[i] == 24))
+      return 0;
+    seen |= 1 << (shifts[i] / 8);
+  }
+  return length;
+}
+
+const char *canvas_init_channels(canvas_t *canvas, uint32_t led_count1, uint32_t led_count2) {
+  canvas->pixels[0] = calloc(led_count1, sizeof(ws2811_led_t));
+  canvas->pixels[1] = calloc(led_count2, sizeof(ws2811_led_t));
+  if ((led_count1 > 0 && canvas->pixels[0] == NULL) || (led_count2 > 0 && canvas->pixels[1] == NULL)) {
+    canvas_free(canvas);
+    return "Unable to allocate memory for the pixels";
+  }
+  canvas->count[0] = led_count1;
+  canvas->count[1] = led_count2;
+  return NULL;
+}
+
+void canvas_free(canvas_t *canvas) {
+  uint8_t ch;
+  free(canvas->topology);
+  canvas->topology = NULL;
+  // Leave nothing for a drawing call to pass its bounds check against
+  canvas->width = 0;
+  canvas->height = 0;
+  for (ch = 0; ch < RPI_PWM_CHANNELS; ch++) {
+    free(canvas->pixels[ch]);
+    canvas->pixels[ch] = NULL;
+    canvas->count[ch] = 0;
+  }
+}
+
+const char *canvas_init(canvas_t *canvas, uint16_t width, uint16_t height) {
+  size_t size = (size_t) width * height * sizeof(uint16_t);
+  if (canvas->topology != NULL) {
+    free(canvas->topology);
+  }
+  canvas->topology = malloc(size);
+  if (canvas->topology == NULL && size > 0) {
+    canvas->width = 0;
+    canvas->height = 0;
+    return "Unable to allocate memory for the canvas";
+  }
+  canvas->width = width;
+  canvas->height = height;
+  // Initialize all offsets to USHRT_MAX
+  memset(canvas->topology, 0xFF, size);
+  return NULL;
+}
+
+const char *canvas_init_pixels(canvas_t *canvas, uint8_t channel, uint16_t offset, uint16_t x, uint16_t y, uint16_t count, int8_t dx, int8_t dy) {
+  if (channel >= RPI_PWM_CHANNELS) {
+    return "Channel must be 0 or 1";
+  }
+  if (offset + count - 1 >= 32767) { // 0xEFFF
+    return "The offset of the last pixel in each channel must be less than 32767.";
+  }
+  if ((uint32_t) offset + count > canvas->count[channel]) {
+    return "Pixels must all be within the LED count of the channel";
+  }
+  if (min(x, x + (count - 1) * dx) < 0 || max(x, x + (count - 1) * dx) >= canvas->width ||
+      min(y, y + (count - 1) * dy) < 0 || max(y, y + (count - 1) * dy) >= canvas->height) {
+    return "Pixels must all be within the bounds of the canvas";
+  }
+  // MSB designates which channel to use
+  offset |= (channel << 15);
+  uint16_t i;
+  for (i = 0; i < count; i++) {
+    debug("  Setting topology(%hu, %hu) to %hu", x, y, offset);
+    canvas->topology[(canvas->width * y) + x] = offset++;
+    x += dx;
+    y += dy;
+  }
+  return NULL;
+}
+
+ws2811_led_t read_pixel(uint16_t x, uint16_t y, const canvas_t *canvas) {
+  uint16_t offset = canvas->topology[(canvas->width * y) + x];
+  ws2811_led_t color;
+  // Ignore canvas locations that weren't initialized with pixels
+  if (offset == USHRT_MAX) {
+    // TODO: We should probably store the whole canvas instead of just the
+    // actually-mapped pixels in the topology so we don't have to do this...
+    // and maybe use OpenGL ES or something to do the low-level drawing.
+    color = (ws2811_led_t) 0x00000000;
+  } else {
+    // MSB designates which channel to use
+    uint8_t channel = offset >> 15;
+    // Clear the MSB so we can use pixel as the offset within the channel
+    offset &= ~(1 << 15);
+    color = canvas->pixels[channel][offset];
+  }
+  debug("  - read_pixel(x: %hu, y: %hu) => 0x%08x", x, y, color);
+  return color;
+
+}
+
+void write_pixel(uint16_t x, uint16_t y, ws2811_led_t color, const canvas_t *canvas) {
+  debug("  - write_pixel(x: %hu, y: %hu, color: 0x%08x)", x, y, color);
+  uint16_t offset = canvas->topology[(canvas->width * y) + x];
+  // Ignore canvas locations that weren't initialized with pixels
+  if (offset != USHRT_MAX) {
+    // MSB designates which channel to use
+    uint8_t channel = offset >> 15;
+    // Clear the MSB so we can use pixel as the offset within the channel
+    offset &= ~(1 << 15);
+    canvas->pixels[channel][offset] = color;
+  }
+}
+
+// Read the color that was sent to the LED at the given canvas location by the
+// last render, after color correction and dithering.
+ws2811_led_t read_output_pixel(uint16_t x, uint16_t y, const ws2811_channel_t *channels, const canvas_t *canvas) {
+  uint16_t offset = canvas->topology[(canvas->width * y) + x];
+  // Ignore canvas locations that weren't initialized with pixels
+  if (offset == USHRT_MAX)
+    return (ws2811_led_t) 0x00000000;
+  // MSB designates which channel to use
+  uint8_t channel = offset >> 15;
+  // Clear the MSB so we can use pixel as the offset within the channel
+  offset &= ~(1 << 15);
+  return channels[channel].leds[offset];
+}
+
+const char *canvas_get_pixel(const canvas_t *canvas, uint16_t x, uint16_t y, ws2811_led_t *color) {
+  if (x + 1 > canvas->width || y + 1 > canvas->height) {
+    return "Cannot read from outside canvas dimensions";
+  }
+  *color = read_pixel(x, y, canvas);
+  return NULL;
+}
+
+const char *canvas_set_pixel(const canvas_t *canvas, uint16_t x, uint16_t y, ws2811_led_t color) {
+  if (x + 1 > canvas->width || y + 1 > canvas->height) {
+    return "Cannot draw outside canvas dimensions";
+  }
+  write_pixel(x, y, color, canvas);
+  return NULL;
+}
+
+const char *canvas_fill(const canvas_t *canvas, uint16_t x, uint16_t y, uint16_t width, uint16_t height, ws2811_led_t color) {
+  if (x + width > canvas->width || y + height > canvas->height) {
+    return "Cannot draw outside canvas dimensions";
+  }
+  uint16_t row, col;
+  for(row = 0; row < height; row++) {
+    for(col = 0; col < width; col++) {
+      write_pixel(x + col, y + row, color, canvas);
+    }
+  }
+  return NULL;
+}
+
+const char *canvas_copy(const canvas_t *canvas, bool copy_null, uint16_t xs, uint16_t ys, uint16_t xd, uint16_t yd, uint16_t width, uint16_t height) {
+  if (xs + width > canvas->width || ys + height > canvas->height || xd + width > canvas->width || yd + height > canvas->height) {
+    return "Cannot draw outside canvas dimensions";
+  }
+  uint16_t row, col;
+  ws2811_led_t *buffer = calloc((size_t) width * height, sizeof(ws2811_led_t));
+  if (buffer == NULL && width > 0 && height > 0) {
+    return "Unable to allocate memory for the copy";
+  }
+  for(row = 0; row < height; row++) {
+    for(col = 0; col < width; col++) {
+      buffer[row * width + col] = read_pixel(xs + col, ys + row, canvas);
+    }
+  }
+  // We have to copy to a temporary buffer and then back so that the copy happens "all at once."
+  ws2811_led_t color;
+  for(row = 0; row < height; row++) {
+    for(col = 0; col < width; col++) {
+      color = buffer[row * width + col];
+      if (color != 0x00000000 || copy_null)
+        write_pixel(xd + col, yd + row, color, canvas);
+    }
+  }
+  free(buffer);
+  return NULL;
+}
+
+const char *canvas_blit(const canvas_t *canvas, uint16_t x, uint16_t y, uint16_t width, uint16_t height, const uint8_t *data, size_t size) {
+  // Each pixel should have 4 8-bit color channels
+  if (size != (size_t) width * height * 4) {
+    return "Size of binary data didn't match the width and height";
+  }
+  if (x + width > canvas->width || y + height > canvas->height) {
+    return "Cannot draw outside canvas dimensions";
+  }
+  uint16_t row, col;
+  size_t offset = 0;
+  ws2811_led_t color;
+  for(row = 0; row < height; row++) {
+    for(col = 0; col < width; col++, offset += 4) {
+      // ws2811_led_t is uint32_t: 0xWWRRGGBB
+      // so data should look like [0xWW, 0xRR, 0xGG, 0xBB]
+      color = data[offset] << 24 | data[offset + 1] << 16 | data[offset + 2] << 8 | data[offset + 3];
+      // Ignore totally black pixels in the source image to allow simple sprite masking.
+      if (color != 0x00000000)
+        write_pixel(x + col, y + row, color, canvas);
+    }
+  }
+  return NULL;
+}
+
+// Check that a region can be read, so that callers can do this before
+// allocating a buffer for it.
+const char *canvas_check_region(const canvas_t *canvas, uint16_t x, uint16_t y, uint16_t width, uint16_t height) {
+  if (x + width > canvas->width || y + height > canvas->height) {
+    return "Cannot read from outside canvas dimensions";
+  }
+  return NULL;
+}
+
+// Read the region into `data`, which must have room for
+// `width * height * bytes_per_pixel` bytes. If `output` is set, this reads
+// what was sent to the LEDs by the last render instead of the canvas.
+const char *canvas_read_region(const canvas_t *canvas, const ws2811_channel_t *channels, uint16_t x, uint16_t y, uint16_t width, uint16_t height, const uint8_t *shifts, uint8_t bytes_per_pixel, bool output, uint8_t *data) {
+  const char *error = canvas_check_region(canvas, x, y, width, height);
+  if (error != NULL) {
+    return error;
+  }
+  size_t offset = 0;
+  uint16_t row, col;
+  uint8_t i;
+  ws2811_led_t color;
+  for(row = 0; row < height; row++) {
+    for(col = 0; col < width; col++) {
+      if (output)
+        color = read_output_pixel(x + col, y + row, channels, canvas);
+      else
+        color = read_pixel(x + col, y + row, canvas);
+      for (i = 0; i < bytes_per_pixel; i++)
+        data[offset++] = color >> shifts[i];
+    }
+  }
+  return NULL;
+}
+
+// Gather the canvas into the LED buffers of each channel, applying its color
+// correction, so that it's ready for ws2811_render.
+void canvas_gather(const canvas_t *canvas, color_stage_t *stages, ws2811_t *ledstring) {
+  uint8_t ch;
+  for (ch = 0; ch < RPI_PWM_CHANNELS; ch++)
+    color_stage_render(&stages[ch], canvas->pixels[ch], ledstring->channel[ch].leds);
+}
@@ -0,0 +1,45 @@
+#ifndef CANVAS_H
+#define CANVAS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "rpi_ws281x/ws2811.h"
+#include "color_stage.h"
+
+// The drawing core shared by the Port executable and the NIF. These functions
+// don't do any I/O other than debug logging, and the ones that can fail return
+// NULL on success or a message describing the error.
+
+typedef struct {
+  uint16_t width;
+  uint16_t height;
+  uint16_t *topology;
+  // The number of LEDs on each channel, which bounds the offsets in topology
+  uint32_t count[RPI_PWM_CHANNELS];
+  // The colors drawn on the canvas for each channel, before color correction
+  ws2811_led_t *pixels[RPI_PWM_CHANNELS];
+} canvas_t;
+
+int parse_strip_type(const char *strip_type);
+uint8_t parse_pixel_format(const char *format, uint8_t *shifts);
+
+const char *canvas_init_channels(canvas_t *canvas, uint32_t led_count1, uint32_t led_count2);
+void canvas_free(canvas_t *canvas);
+const char *canvas_init(canvas_t *canvas, uint16_t width, uint16_t height);
+const char *canvas_init_pixels(canvas_t *canvas, uint8_t channel, uint16_t offset, uint16_t x, uint16_t y, uint16_t count, int8_t dx, int8_t dy);
+
+ws2811_led_t read_pixel(uint16_t x, uint16_t y, const canvas_t *canvas);
+void write_pixel(uint16_t x, uint16_t y, ws2811_led_t color, const canvas_t *canvas);
+ws2811_led_t read_output_pixel(uint16_t x, uint16_t y, const ws2811_channel_t *channels, const canvas_t *canvas);
+
+const char *canvas_get_pixel(const canvas_t *canvas, uint16_t x, uint16_t y, ws2811_led_t *color);
+const char *canvas_set_pixel(const canvas_t *canvas, uint16_t x, uint16_t y, ws2811_led_t color);
+const char *canvas_fill(const canvas_t *canvas, uint16_t x, uint16_t y, uint16_t width, uint16_t height, ws2811_led_t color);
+const char *canvas_copy(const canvas_t *canvas, bool copy_null, uint16_t xs, uint16_t ys, uint16_t xd, uint16_t yd, uint16_t width, uint16_t height);
+const char *canvas_blit(const canvas_t *canvas, uint16_t x, uint16_t y, uint16_t width, uint16_t height, const uint8_t *data, size_t size);
+const char *canvas_check_region(const canvas_t *canvas, uint16_t x, uint16_t y, uint16_t width, uint16_t height);
+const char *canvas_read_region(const canvas_t *canvas, const ws2811_channel_t *channels, uint16_t x, uint16_t y, uint16_t width, uint16_t height, const uint8_t *shifts, uint8_t bytes_per_pixel, bool output, uint8_t *data);
+void canvas_gather(const canvas_t *canvas, color_stage_t *stages, ws2811_t *ledstring);
+
+#endif // CANVAS_H
@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "rpi_ws281x/ws2811.h"
+#include "color_stage.h"
+
+// The largest value in the look-up tables (255 in 8.8 fixed point), which
+// leaves room to add a residual of up to 0xFF without overflowing.
+#define LUT_MAX 0xFF00
+
+// Returns false if the residuals couldn't be allocated.
+bool color_stage_init(color_stage_t *stage, uint32_t count) {
+  uint16_t i;
+  stage->count = count;
+  for (i = 0; i < 256; i++)
+    stage->gamma[i] = i;
+  stage->brightness = 255;
+  for (i = 0; i < COLOR_COMPONENTS; i++)
+    stage->temperature[i] = 255;
+  stage->white_extraction = false;
+  stage->dither = false;
+  stage->residuals = calloc((size_t) count * COLOR_COMPONENTS, sizeof(uint8_t));
+  color_stage_update(stage);
+  return stage->residuals != NULL || count == 0;
+}
+
+void color_stage_free(color_stage_t *stage) {
+  free(stage->residuals);
+  stage->residuals = NULL;
+}
+
+// Rebuild the look-up tables. This must be called after changing the gamma,
+// brightness or temperature so that render only has to do one lookup per
+// component. With the default settings, each entry is exactly `value << 8`.
+void color_stage_update(color_stage_t *stage) {
+  uint16_t value;
+  uint8_t c;
+  for (c = 0; c < COLOR_COMPONENTS; c++) {
+    uint32_t scale = (stage->brightness + 1) * (stage->temperature[c] + 1);
+    // The +1 above keeps full scale exact, but would leave a fraction for
+    // dithering to turn into an occasional 1, so 0 has to mean off.
+    if (stage->brightness == 0 || stage->temperature[c] == 0) {
+      for (value = 0; value < 256; value++)
+        stage->lut[c][value] = stage->gamma[0] << 8;
+      continue;
+    }
+    for (value = 0; value < 256; value++) {
+      // Like ws2811_render, scale the value by the brightness before looking
+      // it up in the gamma table, but interpolate between the neighboring
+      // entries so that the fractional part is kept for dithering.
+      uint32_t scaled = (value * scale) >> 8;
+      uint8_t index = scaled >> 8;
+      int32_t fraction = scaled & 0xFF;
+      int32_t low = stage->gamma[index];
+      int32_t high = stage->gamma[(index < 255) ? index + 1 : 255];
+      stage->lut[c][value] = (low << 8) + (high - low) * fraction;
+    }
+  }
+}
+
+static inline uint16_t min16(uint16_t a, uint16_t b) {
+  return (a < b) ? a : b;
+}
+
+static inline void lookup(const color_stage_t *stage, ws2811_led_t color, uint16_t *components) {
+  uint8_t c;
+  for (c = 0; c < COLOR_COMPONENTS; c++)
+    components[c] = stage->lut[c][(color >> (c * 8)) & 0xFF];
+  if (stage->white_extraction) {
+    // Move the part of the color that all of the RGB components have in
+    // common onto the dedicated white LED.
+    uint16_t white = min16(components[COMPONENT_R], min16(components[COMPONENT_G], components[COMPONENT_B]));
+    components[COMPONENT_R] -= white;
+    components[COMPONENT_G] -= white;
+    components[COMPONENT_B] -= white;
+    components[COMPONENT_W] = min16(components[COMPONENT_W] + white, LUT_MAX);
+  }
+}
+
+// Apply the color correction to a single color, without dithering.
+ws2811_led_t color_stage_apply(const color_stage_t *stage, ws2811_led_t color) {
+  uint16_t components[COLOR_COMPONENTS];
+  ws2811_led_t result = 0;
+  uint8_t c;
+  lookup(stage, color, components);
+  for (c = 0; c < COLOR_COMPONENTS; c++)
+    result |= (ws2811_led_t) (components[c] >> 8) << (c * 8);
+  return result;
+}
+
+// Gather the canvas pixels of a channel into its LED buffer, applying the
+// color correction and, if enabled, temporal dithering.
+void color_stage_render(color_stage_t *stage, const ws2811_led_t *pixels, ws2811_led_t *leds) {
+  uint16_t components[COLOR_COMPONENTS];
+  uint32_t i;
+  uint8_t c;
+  if (!stage->dither) {
+    for (i = 0; i < stage->count; i++)
+      leds[i] = color_stage_apply(stage, pixels[i]);
+    return;
+  }
+  uint8_t *residual = stage->residuals;
+  ws2811_led_t color;
+  for (i = 0; i < stage->count; i++) {
+    lookup(stage, pixels[i], components);
+    color = 0;
+    for (c = 0; c < COLOR_COMPONENTS; c++, residual++) {
+      // Carry the fractional part over to the next frame so that the average
+      // intensity over time matches the corrected value.
+      uint16_t value = components[c] + *residual;
+      *residual = value & 0xFF;
+      color |= (ws2811_led_t) (value >> 8) << (c * 8);
+    }
+    leds[i] = color;
+  }
+}
@@ -0,0 +1,40 @@
+#ifndef COLOR_STAGE_H
+#define COLOR_STAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "rpi_ws281x/ws2811.h"
+
+// Color components are indexed by their byte position in a ws2811_led_t,
+// which is uint32_t: 0xWWRRGGBB
+#define COLOR_COMPONENTS 4
+#define COMPONENT_B 0
+#define COMPONENT_G 1
+#define COMPONENT_R 2
+#define COMPONENT_W 3
+
+// The color correction applied to each pixel of a channel as the canvas is
+// gathered into the LED buffer at render time.
+typedef struct {
+  uint32_t count;
+  uint8_t gamma[256];
+  uint8_t brightness;
+  uint8_t temperature[COLOR_COMPONENTS];
+  bool white_extraction;
+  bool dither;
+  // Fused brightness x temperature, then gamma, for each component, as 8.8
+  // fixed point so that the fractional part can be carried over by dithering.
+  uint16_t lut[COLOR_COMPONENTS][256];
+  // Fractional part left over from the previous frame for each component of
+  // each pixel, used for temporal dithering.
+  uint8_t *residuals;
+} color_stage_t;
+
+bool color_stage_init(color_stage_t *stage, uint32_t count);
+void color_stage_free(color_stage_t *stage);
+void color_stage_update(color_stage_t *stage);
+ws2811_led_t color_stage_apply(const color_stage_t *stage, ws2811_led_t color);
+void color_stage_render(color_stage_t *stage, const ws2811_led_t *pixels, ws2811_led_t *leds);
+
+#endif // COLOR_STAGE_H
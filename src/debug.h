@@ -0,0 +1,12 @@
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include <stdio.h>
+
+#ifdef DEBUG
+#define debug(...) do { printf("DBG: "); printf(__VA_ARGS__); printf("\r\n"); fflush(stdout); } while (0)
+#else
+#define debug(...)
+#endif
+
+#endif // DEBUG_H
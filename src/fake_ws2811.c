@@ -21,6 +21,14 @@ ws2811_return_t ws2811_init(ws2811_t *ws2811) {
   return WS2811_SUCCESS;
 }
 
+void ws2811_fini(ws2811_t *ws2811) {
+  int chan;
+  for (chan = 0; chan < RPI_PWM_CHANNELS; chan++) {
+    free(ws2811->channel[chan].leds);
+    ws2811->channel[chan].leds = NULL;
+  }
+}
+
 ws2811_return_t ws2811_render(ws2811_t *ws2811) {
   debug("Called render()");
   uint8_t ch;
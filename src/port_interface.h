@@ -1,11 +1,7 @@
 #ifndef PORT_INTERFACE_H
 #define PORT_INTERFACE_H
 
-#ifdef DEBUG
-#define debug(...) do { printf("DBG: "); printf(__VA_ARGS__); printf("\r\n"); fflush(stdout); } while (0)
-#else
-#define debug(...)
-#endif
+#include "debug.h"
 
 #define reply_ok() do { printf("OK\r\n"); fflush(stdout); } while(0)
 
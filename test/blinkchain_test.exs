@@ -27,6 +27,121 @@ defmodule Blinkchain.BlinkchainTest do
     :ok
   end
 
+  # A single RGBW strip with white extraction and dithering enabled:
+  # Y  X: 0  1  2  3  4  5  6  7
+  # 0  [  0  1  2  3  4  5  6  7 ] <- RGBW strip on Channel 0 (pin 18)
+  defp with_rgbw_strip(_) do
+    Application.stop(:blinkchain)
+    {:ok, _pid} = HAL.start_link(config: rgbw_strip_config(), subscriber: self())
+    flush()
+    :ok
+  end
+
+  # A canvas that's larger than its pixels, so that reading all of it takes
+  # more than one line of the Port's output:
+  # Y  X: 0  1  2  3  4  5  6  7 ... 19
+  # 0  [  0  1  2  3  4  5  6  7 ]      <- Adafruit NeoPixel Stick on Channel 0 (pin 18)
+  # ...
+  # 19
+  defp with_large_canvas(_) do
+    Application.stop(:blinkchain)
+    {:ok, _pid} = HAL.start_link(config: large_canvas_config(), subscriber: self())
+    flush()
+    :ok
+  end
+
+  defp with_nif_backend(_) do
+    Application.stop(:blinkchain)
+    Application.put_env(:blinkchain, :backend, :nif)
+    on_exit(fn -> Application.delete_env(:blinkchain, :backend) end)
+    {:ok, _pid} = HAL.start_link(config: neopixel_stick_and_unicorn_phat_config())
+    :ok
+  end
+
+  describe "Blinkchain.set_brightness" do
+    setup [:with_neopixel_stick_and_unicorn_phat]
+
+    test "it scales the rendered color of each pixel in the channel" do
+      Blinkchain.set_pixel(%Point{x: 0, y: 0}, %Color{r: 255, g: 0, b: 128, w: 64})
+      Blinkchain.set_pixel(%Point{x: 0, y: 1}, %Color{r: 255, g: 0, b: 128, w: 64})
+      :ok = Blinkchain.set_brightness(0, 127)
+
+      Blinkchain.render()
+      assert_receive "DBG: Called render()"
+      assert_receive "DBG:   [0][0]: 0x207f0040"
+      assert_receive "DBG:   [1][0]: 0x40ff0080"
+    end
+  end
+
+  describe "Blinkchain.set_gamma" do
+    setup [:with_neopixel_stick_and_unicorn_phat]
+
+    test "it transforms each color component of the rendered pixels" do
+      Blinkchain.set_pixel(%Point{x: 0, y: 0}, %Color{r: 255, g: 0, b: 128, w: 64})
+      :ok = Blinkchain.set_gamma(0, Enum.map(0..255, &(255 - &1)))
+      assert_receive "DBG: Called set_gamma(channel: 0, gamma: <binary>)"
+
+      Blinkchain.render()
+      assert_receive "DBG: Called render()"
+      assert_receive "DBG:   [0][0]: 0xbf00ff7f"
+    end
+  end
+
+  describe "Blinkchain.set_color_temperature" do
+    setup [:with_neopixel_stick_and_unicorn_phat]
+
+    test "it scales each color component of the rendered pixels" do
+      Blinkchain.set_pixel(%Point{x: 0, y: 0}, %Color{r: 255, g: 255, b: 255, w: 255})
+      :ok = Blinkchain.set_color_temperature(0, {255, 127, 0})
+      assert_receive "DBG: Called set_color_temperature(channel: 0, r: 255, g: 127, b: 0)"
+
+      Blinkchain.render()
+      assert_receive "DBG: Called render()"
+      assert_receive "DBG:   [0][0]: 0xffff7f00"
+    end
+
+    test "it validates its arguments" do
+      assert {:error, :invalid, :channel} = Blinkchain.set_color_temperature(2, {255, 255, 255})
+      assert {:error, :invalid, :color} = Blinkchain.set_color_temperature(0, {256, 255, 255})
+    end
+  end
+
+  describe "color correction options" do
+    setup [:with_rgbw_strip]
+
+    test "white extraction moves the common part of the RGB components to the white component" do
+      Blinkchain.set_pixel(%Point{x: 0, y: 0}, %Color{r: 255, g: 255, b: 255, w: 0})
+      Blinkchain.set_pixel(%Point{x: 1, y: 0}, %Color{r: 200, g: 100, b: 50, w: 10})
+
+      Blinkchain.render()
+      assert_receive "DBG: Called render()"
+      assert_receive "DBG:   [0][0]: 0xff000000"
+      assert_receive "DBG:   [0][1]: 0x3c963200"
+    end
+
+    test "dithering spreads the fractional part of each component over several frames" do
+      Blinkchain.set_pixel(%Point{x: 0, y: 0}, %Color{r: 1, g: 1, b: 1, w: 0})
+      Blinkchain.set_brightness(0, 100)
+
+      Blinkchain.render()
+      assert_receive "DBG:   [0][0]: 0x00000000"
+      Blinkchain.render()
+      assert_receive "DBG:   [0][0]: 0x00000000"
+      Blinkchain.render()
+      assert_receive "DBG:   [0][0]: 0x01000000"
+    end
+
+    test "dithering leaves the pixels off when the brightness is 0" do
+      Blinkchain.set_pixel(%Point{x: 0, y: 0}, %Color{r: 255, g: 255, b: 255, w: 255})
+      Blinkchain.set_brightness(0, 0)
+
+      Enum.each(1..4, fn _ ->
+        Blinkchain.render()
+        assert_receive "DBG:   [0][0]: 0x00000000"
+      end)
+    end
+  end
+
   describe "Blinkchain.set_pixel" do
     setup [:with_neopixel_stick_and_unicorn_phat]
 
@@ -290,6 +405,97 @@ defmodule Blinkchain.BlinkchainTest do
     end
   end
 
+  describe "Blinkchain.read_region" do
+    setup [:with_neopixel_stick_and_unicorn_phat]
+
+    test "it reads the canvas across multiple channels as RGBW by default" do
+      Blinkchain.set_pixel(%Point{x: 1, y: 0}, %Color{r: 255, g: 0, b: 128, w: 64})
+      Blinkchain.set_pixel(%Point{x: 2, y: 1}, %Color{r: 1, g: 2, b: 3, w: 4})
+
+      assert {:ok, data} = Blinkchain.read_region(%Point{x: 1, y: 0}, 2, 2)
+      assert_receive "DBG: Called read_region(x: 1, y: 0, width: 2, height: 2, format: rgbw, source: canvas)"
+      assert data == <<255, 0, 128, 64, 0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 3, 4>>
+    end
+
+    test "it reads the canvas in the requested pixel format" do
+      Blinkchain.set_pixel(%Point{x: 0, y: 0}, %Color{r: 255, g: 0, b: 128, w: 64})
+
+      assert {:ok, <<0, 255, 128>>} = Blinkchain.read_region({0, 0}, 1, 1, format: :grb)
+      assert {:ok, <<64, 255, 0, 128>>} = Blinkchain.read_region({0, 0}, 1, 1, format: :wrgb)
+    end
+
+    test "it reads the output of the last render" do
+      Blinkchain.set_pixel(%Point{x: 0, y: 0}, %Color{r: 255, g: 0, b: 128, w: 64})
+      Blinkchain.set_brightness(0, 127)
+      Blinkchain.render()
+
+      assert {:ok, <<255, 0, 128, 64>>} = Blinkchain.read_region({0, 0}, 1, 1)
+      assert {:ok, <<127, 0, 64, 32>>} = Blinkchain.read_region({0, 0}, 1, 1, output: true)
+      assert_receive "DBG: Called read_region(x: 0, y: 0, width: 1, height: 1, format: rgbw, source: output)"
+    end
+
+    test "it validates its arguments" do
+      assert {:error, :invalid, :format} = Blinkchain.read_region({0, 0}, 1, 1, format: :rgbx)
+      assert {:error, :invalid, :format} = Blinkchain.read_region({0, 0}, 1, 1, format: :rgw)
+      assert {:error, :invalid, :output} = Blinkchain.read_region({0, 0}, 1, 1, output: :yes)
+      assert {:error, "Cannot read from outside canvas dimensions"} = Blinkchain.read_region({0, 0}, 9, 1)
+    end
+  end
+
+  describe "Blinkchain.read_region on a large canvas" do
+    setup [:with_large_canvas]
+
+    test "it reassembles replies that are longer than a line from among the debug output" do
+      Blinkchain.set_pixel(%Point{x: 7, y: 0}, %Color{r: 1, g: 2, b: 3, w: 4})
+
+      assert {:ok, data} = Blinkchain.read_region({0, 0}, 20, 20)
+      assert_receive "DBG: Called read_region(x: 0, y: 0, width: 20, height: 20, format: rgbw, source: canvas)"
+      assert byte_size(data) == 20 * 20 * 4
+      assert <<0::size(28)-unit(8), 1, 2, 3, 4, rest::binary>> = data
+      assert rest == <<0::size(1568)-unit(8)>>
+    end
+  end
+
+  describe "the NIF backend" do
+    setup [:with_nif_backend]
+
+    test "it draws on the canvas across multiple channels" do
+      assert :ok = Blinkchain.fill(%Point{x: 2, y: 0}, 2, 2, %Color{r: 255, g: 0, b: 128})
+      assert :ok = Blinkchain.copy(%Point{x: 2, y: 0}, %Point{x: 0, y: 0}, 1, 2)
+      assert :ok = Blinkchain.blit({5, 1}, 1, 1, [{1, 2, 3, 4}])
+      assert :ok = Blinkchain.render()
+
+      assert {:ok, data} = Blinkchain.read_region({0, 0}, 4, 2, format: :rgb)
+
+      assert data ==
+               <<255, 0, 128, 0, 0, 0, 255, 0, 128, 255, 0, 128>> <>
+                 <<255, 0, 128, 0, 0, 0, 255, 0, 128, 255, 0, 128>>
+
+      assert {:ok, <<2, 3, 4, 1>>} = Blinkchain.read_region({5, 1}, 1, 1)
+    end
+
+    test "it reads the output of the last render" do
+      Blinkchain.set_pixel(%Point{x: 0, y: 0}, %Color{r: 255, g: 0, b: 128, w: 64})
+      assert :ok = Blinkchain.set_brightness(0, 127)
+      assert :ok = Blinkchain.render()
+
+      assert {:ok, <<127, 0, 64, 32>>} = Blinkchain.read_region({0, 0}, 1, 1, output: true)
+    end
+
+    test "it returns errors from the drawing core" do
+      assert {:error, "Cannot draw outside canvas dimensions"} = Blinkchain.fill({7, 0}, 2, 1, {255, 0, 0})
+      assert {:error, "Cannot read from outside canvas dimensions"} = Blinkchain.read_region({0, 0}, 65535, 65535)
+    end
+
+    test "it doesn't map pixels beyond the LED count of a channel" do
+      # Channel 0 is the NeoPixel Stick, with 8 LEDs
+      assert {:error, "Pixels must all be within the LED count of the channel"} =
+               Blinkchain.NIF.init_pixels(0, 4, 0, 1, 5, 1, 0)
+
+      assert :ok = Blinkchain.NIF.init_pixels(0, 4, 0, 1, 4, 1, 0)
+    end
+  end
+
   defp flush(type \\ :silent, opts \\ [])
 
   defp flush(:silent, opts) do
@@ -311,6 +517,43 @@ defmodule Blinkchain.BlinkchainTest do
     end
   end
 
+  defp large_canvas_config do
+    [
+      canvas: {20, 20},
+      channel0: [
+        pin: 18,
+        arrangement: [
+          %{
+            type: :strip,
+            origin: {0, 0},
+            count: 8,
+            direction: :right
+          }
+        ]
+      ]
+    ]
+  end
+
+  defp rgbw_strip_config do
+    [
+      canvas: {8, 1},
+      channel0: [
+        pin: 18,
+        type: :grbw,
+        white_extraction: true,
+        dither: true,
+        arrangement: [
+          %{
+            type: :strip,
+            origin: {0, 0},
+            count: 8,
+            direction: :right
+          }
+        ]
+      ]
+    ]
+  end
+
   defp neopixel_stick_and_unicorn_phat_config do
     [
       canvas: {8, 5},
@@ -187,5 +187,75 @@ defmodule Blinkchain.ConfigTest do
                pin: 18
              }
     end
+
+    test "with color correction options" do
+      config = [
+        canvas: {8, 1},
+        channel0: [
+          pin: 18,
+          type: :grbw,
+          color_temperature: {255, 224, 140},
+          dither: true,
+          white_extraction: true,
+          arrangement: [
+            %{
+              type: :strip,
+              origin: {0, 0},
+              count: 8,
+              direction: :right
+            }
+          ]
+        ]
+      ]
+
+      %Config{channel0: ch0} = Config.load(config)
+
+      assert ch0 == %Channel{
+               arrangement: [%Strip{origin: {0, 0}, count: 8, direction: :right}],
+               color_temperature: {255, 224, 140},
+               dither: true,
+               number: 0,
+               pin: 18,
+               type: :grbw,
+               white_extraction: true
+             }
+    end
+
+    test "with white extraction on a channel without a white component" do
+      config = [
+        canvas: {8, 1},
+        channel0: [
+          pin: 18,
+          type: :grb,
+          white_extraction: true,
+          arrangement: [
+            %{
+              type: :strip,
+              origin: {0, 0},
+              count: 8,
+              direction: :right
+            }
+          ]
+        ]
+      ]
+
+      assert_raise RuntimeError, ~r/white_extraction requires one of the RGBW types/, fn -> Config.load(config) end
+    end
+
+    test "with the NIF backend" do
+      Application.put_env(:blinkchain, :backend, :nif)
+      on_exit(fn -> Application.delete_env(:blinkchain, :backend) end)
+
+      assert %Config{backend: :nif} = Config.load(canvas: {1, 1}, channel0: [pin: 18, arrangement: []])
+    end
+
+    test "with an invalid backend" do
+      Application.put_env(:blinkchain, :backend, :serial)
+      on_exit(fn -> Application.delete_env(:blinkchain, :backend) end)
+
+      assert_raise RuntimeError, ~r/backend must be :port or :nif/, fn ->
+        Config.load(canvas: {1, 1}, channel0: [pin: 18, arrangement: []])
+      end
+    end
   end
 end